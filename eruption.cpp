@@ -1,21 +1,48 @@
 
+//Standard library only, all the operator kernels need
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <limits>
+
+//Built with ERUPTION_KERNELS_ONLY defined, this file is only the operator kernels, for genomes compiled by --compile
+#ifndef ERUPTION_KERNELS_ONLY
+
 //Using SDL, SDL_image, standard IO, and, strings
 #include <SDL.h>
 #include <SDL_image.h>
 #include <SDL_ttf.h>
 #include <stdio.h>
 #include <string>
-#include <string.h>
-#include <math.h>
 #include <sstream>
 #include <cstdlib>
 #include <time.h>
 #include <vector>
 #include <iostream>
 #include <bitset>
-#include <algorithm>
 #include <stdlib.h>
-#include <limits>
+#include <fstream>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <list>
+#include <map>
+#include <dirent.h>
+#include <dlfcn.h>
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#endif
 
 //Texture wrapper class
 class LTexture
@@ -64,6 +91,9 @@ public:
     int getPitch();
     Uint32 getPixel32( unsigned int x, unsigned int y );
 
+    //Uploads packed RGBA8888 rows into part of a streaming texture
+    bool updatePixels( SDL_Rect* rect, void* pixels, int pitch );
+
 private:
     //The actual hardware texture
     SDL_Texture* mTexture;
@@ -100,6 +130,18 @@ LTexture gTextTexture2;
 LTexture gTextTexture3;
 LTexture gTextTexture4;
 
+//Toolbar buttons under the art
+const int BUTTON_GALLERY = 0;
+const int BUTTON_EXPLORE = 1;
+const int BUTTON_SAVE = 2;
+const int BUTTON_LIBRARY = 3;
+const int BUTTON_UNDO = 4;
+const int BUTTON_REDO = 5;
+const int BUTTONS = 6;
+std::string gButtonLabels[BUTTONS] = { "Gallery", "Explore", "Save", "Library", "Undo", "Redo" };
+LTexture gButtonText[BUTTONS];
+SDL_Rect gButtonRects[BUTTONS];
+
 LTexture::LTexture()
 {
     //Initialize
@@ -375,6 +417,20 @@ Uint32 LTexture::getPixel32( unsigned int x, unsigned int y )
     return pixels[ ( y * ( mPitch / 4 ) ) + x ];
 }
 
+bool LTexture::updatePixels( SDL_Rect* rect, void* pixels, int pitch )
+{
+    bool success = true;
+
+    //Copy straight into the texture without locking it
+    if( SDL_UpdateTexture( mTexture, rect, pixels, pitch ) != 0 )
+    {
+        SDL_Log( "Unable to update texture! %s\n", SDL_GetError() );
+        success = false;
+    }
+
+    return success;
+}
+
 bool init()
 {
     //Initialization flag
@@ -433,7 +489,7 @@ bool loadMedia()
     gSkyBlue.loadFromFile("eruption/skyblue.png");
 
     gTargetTexture.createBlank( gScreenRect.w,gScreenRect.h, SDL_TEXTUREACCESS_TARGET );
-    gArt.createBlank( gScreenRect.w,gScreenRect.h, SDL_TEXTUREACCESS_TARGET );
+    gArt.createBlank( gScreenRect.w * .25, gScreenRect.w * .25, SDL_TEXTUREACCESS_STREAMING );
 
     //Fonts
     gFont = TTF_OpenFont( "eruption/clacon.ttf", 56 ); //Font Size
@@ -442,6 +498,9 @@ bool loadMedia()
     gTextTexture2.loadFromRenderedText("Error", textColor);
     gTextTexture3.loadFromRenderedText("Error", textColor);
     gTextTexture4.loadFromRenderedText("Error", textColor);
+    for (int n = 0; n < BUTTONS; n++){
+        gButtonText[n].loadFromRenderedText(gButtonLabels[n], textColor);
+    }
 
     return success;
 }
@@ -455,6 +514,9 @@ void close()
     gTextTexture2.free();
     gTextTexture3.free();
     gTextTexture4.free();
+    for (int n = 0; n < BUTTONS; n++){
+        gButtonText[n].free();
+    }
 
     TTF_CloseFont( gFont );
     gFont = NULL;
@@ -478,6 +540,10 @@ const int NUMBER = 0,
           VECTOR = 3;
 
 
+//Registry lookups, defined with the operator table, -1 for names they don't know
+int findOperator(const std::string& name);
+int findVariable(const std::string& name);
+
 struct Node{
 
     int kind;
@@ -486,19 +552,27 @@ struct Node{
     Node* g;
     Node* b;
     std::string op;
+    int code; //op's index in OPERATORS or VARIABLES, set by setOp
 
     Node* left;
     Node* right;
 
+    //Owners sharing the node, deleteTree frees it when the last one lets go
+    SDL_atomic_t refs;
+
     Node( double val ) {
         kind = NUMBER;
         number = val;
+        code = -1;
+        SDL_AtomicSet(&refs, 1);
         this->left = NULL;
         this->right = NULL;
     }
 
     Node( Node* r, Node* g, Node* b ) {
         kind = VECTOR;
+        code = -1;
+        SDL_AtomicSet(&refs, 1);
         this->r = r;
         this->g = g;
         this->b = b;
@@ -509,18 +583,40 @@ struct Node{
 
     Node( std::string val, Node* none) {
         kind = VARIABLE;
-        op = val;
+        setOp(val);
+        SDL_AtomicSet(&refs, 1);
         this->left = NULL;
         this->right = NULL;
     }
 
     Node( std::string op, Node *left, Node *right ) {
         kind = OPERATOR;
-        this->op = op;
+        setOp(op);
+        SDL_AtomicSet(&refs, 1);
         this->left = left;
         this->right = right;
     }
 
+    //Same fields and children with a single owner, the children are not given new references
+    Node( const Node& other ) {
+        kind = other.kind;
+        number = other.number;
+        r = other.r;
+        g = other.g;
+        b = other.b;
+        op = other.op;
+        code = other.code;
+        left = other.left;
+        right = other.right;
+        SDL_AtomicSet(&refs, 1);
+    }
+
+    //Name an operator or variable, for the node's current kind
+    void setOp( std::string val ) {
+        op = val;
+        code = kind == VARIABLE ? findVariable(val) : findOperator(val);
+    }
+
     double get_Number(){
         return number;
     }
@@ -531,6 +627,9 @@ struct Node{
 
 };
 
+//Whether two trees are the same genome, defined with the lineage journal
+bool sameTree(Node* a, Node* b);
+
 union data{
     double input;
     unsigned long long output;
@@ -611,492 +710,7220 @@ Node* recur(Node* prev){
 
 
 /*
- * Delete Tree Recursively
+ * Delete Tree Recursively, letting go of one reference and freeing the nodes nobody else shares
  */
 void  deleteTree(Node* prev){
+    if (!SDL_AtomicDecRef(&prev->refs)){
+        return;
+    }
     if (prev->left != NULL && prev->kind == OPERATOR){
-        recur(prev->left);
+        deleteTree(prev->left);
     }
     if (prev->right != NULL && prev->kind == OPERATOR){
-        recur(prev->right);
+        deleteTree(prev->right);
     }
     if (prev->kind == VECTOR){
-        recur(prev->r);
-        recur(prev->g);
-        recur(prev->b);
+        deleteTree(prev->r);
+        deleteTree(prev->g);
+        deleteTree(prev->b);
     }
     delete prev;
 }
 
-std::bitset<sizeof(double) * CHAR_BIT> message;
-std::string messages;
-
-
 /*
- * Calculate Equation
+ * Share a tree. Trees are never changed once built, so a copy is one more reference to the same nodes
  */
-double getValue( Node *node ) {
+Node* copyTree(Node* prev){
+    SDL_AtomicIncRef(&prev->refs);
+    return prev;
+}
 
-    if ( node->kind == NUMBER ) {
-        return node->number;
+/*
+ * Copy Tree Recursively, for the rare caller that has to change nodes in place
+ */
+Node* cloneTree(Node* prev){
+    Node* node = new Node(*prev);
+    node->left = NULL;
+    node->right = NULL;
+    if (prev->kind == OPERATOR){
+        if (prev->left != NULL) node->left = cloneTree(prev->left);
+        if (prev->right != NULL) node->right = cloneTree(prev->right);
     }
-
-    if ( node->kind == VECTOR ) {
-        if (color_num == 0){ return getValue(node->r); }
-        if (color_num == 1){ return getValue(node->g); }
-        return getValue(node->b);
+    if (prev->kind == VECTOR){
+        node->r = cloneTree(prev->r);
+        node->g = cloneTree(prev->g);
+        node->b = cloneTree(prev->b);
     }
+    return node;
+}
 
-    if ( node->kind == VARIABLE ) {
-        if ( node-> op == "X"){
-            return frag_x;
-        }
-        if ( node-> op == "Y"){
-            return frag_y;
-        }
+/*
+ * Write a tree as a prefix expression that readGenome can load back exactly,
+ * (op left right) for operators and #[r g b] for color vectors
+ */
+void writeGenome(Node* prev, std::ostream& out){
+    if (prev == NULL){
+        out << "0";
+        return;
     }
 
-    double leftVal, rightVal;
-    if (node->left != NULL) {
-        leftVal = getValue(node->left);
+    if (prev->kind == NUMBER){
+        char number[32];
+        snprintf(number, sizeof(number), "%.17g", prev->number);
+        out << number;
+    }
+    if (prev->kind == VARIABLE){
+        out << prev->op;
+    }
+    if (prev->kind == VECTOR){
+        out << "#[";
+        writeGenome(prev->r, out);
+        out << " ";
+        writeGenome(prev->g, out);
+        out << " ";
+        writeGenome(prev->b, out);
+        out << "]";
+    }
+    if (prev->kind == OPERATOR){
+        out << "(" << prev->op << " ";
+        writeGenome(prev->left, out);
+        out << " ";
+        writeGenome(prev->right, out);
+        out << ")";
     }
-    if (node->right != NULL) {
-        rightVal = getValue(node->right);
-    }
-
-    std::string opt = node->op;
-    if (opt == "+") return leftVal + rightVal;
-    if (opt == "-") return leftVal - rightVal;
-    if (opt == "*") return leftVal * rightVal;
-    if (opt == "/") return leftVal / rightVal;
-    if (opt == "Mod") return std::fmod(leftVal, rightVal);
-    if (opt == "Min") return std::min(leftVal, rightVal);
-    if (opt == "Max") return std::max(leftVal, rightVal);
-    if (opt == "And"){
-        unsigned long long tempL = reinterpret_cast<unsigned long long &>(leftVal);
-        unsigned long long tempR = reinterpret_cast<unsigned long long &>(rightVal);
-        auto tempF = tempR & tempL;
-        double value = *(double*)&tempF;
-        return value;
-    }
-    if (opt == "Or"){
-        unsigned long long tempL = reinterpret_cast<unsigned long long &>(leftVal);
-        unsigned long long tempR = reinterpret_cast<unsigned long long &>(rightVal);
-        auto tempF = tempR | tempL;
-        double value = *(double*)&tempF;
-        return value;
-    }
-    if (opt == "Xor"){
-        unsigned long long tempL = reinterpret_cast<unsigned long long &>(leftVal);
-        unsigned long long tempR = reinterpret_cast<unsigned long long &>(rightVal);
-        auto tempF = tempR ^ tempL;
-        double value = *(double*)&tempF;
-        return value;
-    }
-
-    //Only Right Value Matters
-    if (opt == "Abs") return abs(rightVal);
-    if (opt == "Round") return round(rightVal);
-    if (opt == "Expt") return exp(rightVal);
-    if (opt == "Log") return log(rightVal);
-    if (opt == "Sin") return (sin(rightVal * 12)+1.0) / 2.0;
-    if (opt == "Cos") return (cos(rightVal * 12)+1.0) / 2.0;
-    if (opt == "aTan") return atan(rightVal* 12);
-    if (opt == "Invert") {
-        unsigned long long tempR = reinterpret_cast<unsigned long long &>(rightVal);
-        auto tempF = ~tempR;
-        double value = *(double *)&tempF;
-        return value;
-    }
-
-}
-
-std::string randomOp(){
-    int r = rand() % 18;
-    if (r == 0) return "+";
-    if (r == 1) return "-";
-    if (r == 2) return "*";
-    if (r == 3) return "/";
-    if (r == 4) return "Mod";
-    if (r == 5) return "Min";
-    if (r == 6) return "Max";
-    if (r == 7) return "And";
-    if (r == 8) return "Or";
-    if (r == 9) return "Xor";
-
-    if (r == 10) return "Abs";
-    if (r == 11) return "Round";
-    if (r == 12) return "Expt";
-    if (r == 13) return "Log";
-    if (r == 14) return "Sin";
-    if (r == 15) return "Cos";
-    if (r == 16) return "aTan";
-    if (r == 17) return "Invert";
-    return "*";
+}
+
+std::string genomeToString(Node* prev){
+    std::ostringstream out;
+    writeGenome(prev, out);
+    return out.str();
 }
 
 /*
- * DPS to mutate random operators into new types
+ * Next token of a genome: ( ) #[ ] or an atom
  */
-Node* mutateExpression(Node *prev, int depth){
-    current = prev;
-    if (depth > 4){
-        return NULL;
+std::string readToken(std::istream& in){
+    char c;
+    while (in.get(c) && isspace((unsigned char)c)) {}
+    if (!in) return "";
+    if (c == '(' || c == ')' || c == ']') return std::string(1, c);
+    if (c == '#' && in.peek() == '['){
+        in.get(c);
+        return "#[";
     }
 
-    if (prev->kind == OPERATOR){
-        if (prev->left != NULL){
-            mutateExpression(prev->left, depth+1);
-        }else{
-            prev->left =  new Node(rand() % 100 / 100.0);
-        }
-        if (prev->right != NULL){
-            mutateExpression(prev->right, depth+1);
-        }else{
-            prev->right =  new Node(rand() % 100 / 100.0);
+    std::string token(1, c);
+    while (in.peek() != EOF && !isspace(in.peek()) && in.peek() != '(' && in.peek() != ')' && in.peek() != ']' && in.peek() != '#'){
+        token += (char)in.get();
+    }
+    return token;
+}
+
+Node* parseGenome(std::istream& in, std::string token){
+    if (token == "(") {
+        std::string op = readToken(in);
+        Node* left = parseGenome(in, readToken(in));
+        Node* right = left != NULL ? parseGenome(in, readToken(in)) : NULL;
+        if (right == NULL || op.empty() || readToken(in) != ")"){
+            if (left != NULL) deleteTree(left);
+            if (right != NULL) deleteTree(right);
+            return NULL;
         }
-        int r = rand() % 10;
-        if (r <= 1) {
-            prev->op = randomOp();
+        return new Node(op, left, right);
+    }
+
+    if (token == "#[") {
+        Node* r = parseGenome(in, readToken(in));
+        Node* g = r != NULL ? parseGenome(in, readToken(in)) : NULL;
+        Node* b = g != NULL ? parseGenome(in, readToken(in)) : NULL;
+        if (b == NULL || readToken(in) != "]"){
+            if (r != NULL) deleteTree(r);
+            if (g != NULL) deleteTree(g);
+            if (b != NULL) deleteTree(b);
+            return NULL;
         }
-        return prev;
+        return new Node(r, g, b);
     }
 
+    if (token.empty() || token == ")" || token == "]") {
+        return NULL;
+    }
 
-    if (prev->kind == NUMBER && rand()%2 == 0){
-        int r = rand() % 10;
-        if (r <= 2){
-            double rgb_new[3] = {rand() % 100 / 100.0, rand() % 100 / 100.0, rand() % 100 / 100.0};
-            prev->kind = VECTOR;
-            prev->r = new Node(rgb_new[0]);
-            prev->g = new Node(rgb_new[1]);
-            prev->b = new Node(rgb_new[2]);
-            return prev;
-        }else if (r <= 5){
-            prev->kind = VARIABLE;
-            int c = rand() % 2;
-            if (c == 0) prev->op = "X";
-            if (c == 1) prev->op = "Y";
-            return prev;
-        }
-        prev->number = rand()%100/100.0;
+    //Anything that reads fully as a number is one, otherwise it names a variable
+    char* end;
+    double number = strtod(token.c_str(), &end);
+    if (*end == '\0'){
+        return new Node(number);
     }
+    return new Node(token, NULL);
+}
 
-    if (prev->kind == VARIABLE && rand()%2 == 0) {
-        int c = rand() % 3;
-        if (c == 0) prev->op = "X";
-        if (c == 1) prev->op = "Y";
-        /*if (c == 2){
-            prev->kind = OPERATOR;
-            prev->left = x_var;
-            prev->right = new Node(rand()%100/100.0);
-            prev->op = randomOp();
+/*
+ * Read a tree written by writeGenome, NULL if it is malformed
+ */
+Node* readGenome(std::istream& in){
+    return parseGenome(in, readToken(in));
+}
 
-        }*/
+Node* genomeFromString(std::string text){
+    std::istringstream in(text);
+    return readGenome(in);
+}
+
+Uint64 mixHash(Uint64 hash, Uint64 value){
+    hash ^= value + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    return hash * 0xFF51AFD7ED558CCDULL;
+}
+
+/*
+ * Hash of a tree's structure and values, equal trees hash the same however they were written
+ */
+Uint64 hashGenome(Node* prev){
+    if (prev == NULL){
+        return 0;
     }
 
-    if (prev->kind == VECTOR && rand()%2 == 0){
-        int r = rand() % 10;
-        if (r <= 1){
-            deleteTree(prev->r);
-            deleteTree(prev->g);
-            deleteTree(prev->b);
-            prev->kind = NUMBER;
-            prev->number = rand()%100;
-            return prev;
-        }else if (r <= 3){
-            mutateExpression(prev->r, depth + 1);
-            mutateExpression(prev->g, depth + 1);
-            mutateExpression(prev->b, depth + 1);
-            return prev;
+    Uint64 hash = mixHash(0, prev->kind + 1);
+    if (prev->kind == NUMBER){
+        data bits;
+        bits.input = prev->number;
+        hash = mixHash(hash, bits.output);
+    }
+    if (prev->kind == VARIABLE || prev->kind == OPERATOR){
+        for (size_t n = 0; n < prev->op.size(); n++){
+            hash = mixHash(hash, (unsigned char)prev->op[n]);
         }
     }
-
-    int r = rand() % 10;
-    if (r <= 2) {
-        prev->kind = OPERATOR;
-        prev->left = new Node(rand()%100 / 100.0);
-        prev->right = new Node(rand()%100 / 100.0);
-        prev->op = randomOp();
-        return prev;
+    if (prev->kind == VECTOR){
+        hash = mixHash(hash, hashGenome(prev->r));
+        hash = mixHash(hash, hashGenome(prev->g));
+        hash = mixHash(hash, hashGenome(prev->b));
+    }
+    if (prev->kind == OPERATOR){
+        hash = mixHash(hash, hashGenome(prev->left));
+        hash = mixHash(hash, hashGenome(prev->right));
     }
+    return hash;
+}
 
-    return prev;
+#endif
+
+unsigned long long bitsOf(double value){
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
 }
 
+double fromBits(unsigned long long bits){
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
 
+/*
+ * What operators hand on to the next: NaN, infinities, subnormals and -0 all become 0, so
+ * bitwise operators never read platform-specific NaN bits and nothing downstream hits
+ * slow subnormal arithmetic. A select rather than a branch, so span loops stay vectorized
+ */
+inline double canonical(double v){
+    double magnitude = std::fabs(v);
+    return magnitude >= std::numeric_limits<double>::min() && magnitude <= std::numeric_limits<double>::max() ? v : 0.0;
+}
 
+/*
+ * Count a span of operator results that are NaN or infinite, canonicalizing them too when asked
+ */
+int canonicalize(double* values, int count, bool replace){
+    int broken = 0;
+    for (int i = 0; i < count; i++){
+        broken += !(std::fabs(values[i]) <= std::numeric_limits<double>::max());
+    }
+    if (replace){
+        for (int i = 0; i < count; i++){
+            values[i] = canonical(values[i]);
+        }
+    }
+    return broken;
+}
 
+inline double addKernel(double l, double r){ return l + r; }
+inline double subtractKernel(double l, double r){ return l - r; }
+inline double multiplyKernel(double l, double r){ return l * r; }
+inline double divideKernel(double l, double r){ return l / r; }
+inline double modKernel(double l, double r){ return std::fmod(l, r); }
+inline double minKernel(double l, double r){ return std::min(l, r); }
+inline double maxKernel(double l, double r){ return std::max(l, r); }
+inline double andKernel(double l, double r){ return fromBits(bitsOf(r) & bitsOf(l)); }
+inline double orKernel(double l, double r){ return fromBits(bitsOf(r) | bitsOf(l)); }
+inline double xorKernel(double l, double r){ return fromBits(bitsOf(r) ^ bitsOf(l)); }
+inline double absKernel(double l, double r){ return std::fabs(r); }
+inline double roundKernel(double l, double r){ return round(r); }
+inline double exptKernel(double l, double r){ return exp(r); }
+inline double logKernel(double l, double r){ return log(r); }
+inline double sinKernel(double l, double r){ return (sin(r * 12) + 1.0) / 2.0; }
+inline double cosKernel(double l, double r){ return (cos(r * 12) + 1.0) / 2.0; }
+inline double atanKernel(double l, double r){ return atan(r * 12); }
+inline double invertKernel(double l, double r){ return fromBits(~bitsOf(r)); }
+
+//Noise lattice: a fixed shuffle of 0-255 repeated twice, and eight gradient directions
+struct NoiseTables{
+
+    int perm[512];
+    double gradX[8];
+    double gradY[8];
+
+    NoiseTables() {
+        //Fixed seed, so every machine rendering a genome sees the same noise
+        uint64_t state = 0x2545F4914F6CDD1DULL;
+        for (int n = 0; n < 256; n++) perm[n] = n;
+        for (int n = 255; n > 0; n--){
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            std::swap(perm[n], perm[(state * 2685821657736338717ULL >> 33) % (n + 1)]);
+        }
+        for (int n = 0; n < 256; n++) perm[n + 256] = perm[n];
+        for (int n = 0; n < 8; n++){
+            gradX[n] = cos(n * M_PI / 4);
+            gradY[n] = sin(n * M_PI / 4);
+        }
+    }
 
-int main( int argc, char* args[] )
-{
+};
 
-    srand(time(0));
-    init();
+const NoiseTables NOISE;
 
-    loadMedia();
+//Noise repeats every 256 lattice cells, so farther out it is flat rather than overflowing the lattice index
+const double NOISE_LIMIT = 1e9;
 
-    //Main loop flag
-    bool quit = false;
+//Lattice cells across the default view's [-1,1] square
+const double NOISE_FREQUENCY = 4;
 
-    //Event handler
-    SDL_Event e;
+inline double noiseFade(double t){
+    return t * t * t * (t * (t * 6 - 15) + 10);
+}
 
-    //Touch variables
-    SDL_Point touchLocation = { gScreenRect.w / 2, gScreenRect.h / 2 };
-    //LTexture* currentTexture = &gItemSpark;
+inline double noiseGradient(int hash, double dx, double dy){
+    return NOISE.gradX[hash & 7] * dx + NOISE.gradY[hash & 7] * dy;
+}
 
-    SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_BLEND);
+/*
+ * Perlin gradient noise, within about [-0.71, 0.71]
+ */
+inline double perlin(double x, double y){
+    if (!(std::fabs(x) < NOISE_LIMIT && std::fabs(y) < NOISE_LIMIT)) return 0;
+    double fx = floor(x);
+    double fy = floor(y);
+    int xi = (int)fx & 255;
+    int yi = (int)fy & 255;
+    double dx = x - fx;
+    double dy = y - fy;
+    double u = noiseFade(dx);
+    double v = noiseFade(dy);
+    const int* perm = NOISE.perm;
+    double n00 = noiseGradient(perm[perm[xi] + yi], dx, dy);
+    double n10 = noiseGradient(perm[perm[xi + 1] + yi], dx - 1, dy);
+    double n01 = noiseGradient(perm[perm[xi] + yi + 1], dx, dy - 1);
+    double n11 = noiseGradient(perm[perm[xi + 1] + yi + 1], dx - 1, dy - 1);
+    double bottom = n00 + u * (n10 - n00);
+    double top = n01 + u * (n11 - n01);
+    return bottom + v * (top - bottom);
+}
 
-    bool holding = false;
-    bool clearAll = true;
-    int fade = 0;
-    int delay = 0;
-    clock_t start, diff;
-    int msec;
-    srand (time(NULL));
+inline double noiseToColor(double n){
+    return std::min(1.0, std::max(0.0, n * M_SQRT1_2 + 0.5));
+}
 
-    double line_y = 0;
-    double line_y_old = 0;
-    double r_x = gScreenRect.w * .25;
-    double r_y = gScreenRect.w * .25;
+//Noise of the point (left, right)
+inline double noiseKernel(double l, double r){
+    return noiseToColor(perlin(l * NOISE_FREQUENCY, r * NOISE_FREQUENCY));
+}
 
-    //While application is running
-    while( !quit )
-    {
-        start = clock();
-        //Handle events on queue
-        while( SDL_PollEvent( &e ) != 0 )
-        {
-            //User requests quit
-            if( e.type == SDL_QUIT )
-            {
-                quit = true;
-            }
-                //Window event
-            else if( e.type == SDL_WINDOWEVENT )
-            {
+//Noise looked up at a point pushed around by two more noise fields
+inline double warpKernel(double l, double r){
+    double x = l * NOISE_FREQUENCY;
+    double y = r * NOISE_FREQUENCY;
+    double wx = perlin(x + 5.2, y + 1.3);
+    double wy = perlin(x + 1.7, y + 9.2);
+    return noiseToColor(perlin(x + 4 * wx, y + 4 * wy));
+}
 
-            }
-                //Touch down
-            else if( e.type == SDL_FINGERDOWN )
-            {
-                touchLocation.x = e.tfinger.x * gScreenRect.w;
-                touchLocation.y = e.tfinger.y * gScreenRect.h;
-            }
-                //Touch motion
-            else if( e.type == SDL_FINGERMOTION )
-            {
-                touchLocation.x = e.tfinger.x * gScreenRect.w;
-                touchLocation.y = e.tfinger.y * gScreenRect.h;
-                holding = true;
-            }
-                //Touch release
-            else if( e.type == SDL_FINGERUP )
-            {
-                touchLocation.x = e.tfinger.x * gScreenRect.w;
-                touchLocation.y = e.tfinger.y * gScreenRect.h;
-                holding = false;
-            }
-        }
+//Spatial operators sample their right child around the point, each sample adding into two sums
+struct Tap{
+    double dx;
+    double dy;
+    double a;
+    double b;
+};
 
-        gTargetTexture.setAsRenderTarget();
+//Farthest a spatial operator samples from the point, reached when its left child is 1 or more
+const double SPATIAL_RADIUS = 0.05;
 
+inline double spatialRadius(double l){
+    double size = std::fabs(l);
+    return (size < 1 ? size : 1) * SPATIAL_RADIUS;
+}
 
-        if (clearAll == true) {
-            //Clear screen
-            SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0x00, 0xFF );
-            SDL_RenderClear( gRenderer );
+//Blur averages a plus of five samples
+const Tap BLUR_TAPS[] = { { 0, 0, .2, 0 }, { -1, 0, .2, 0 }, { 1, 0, .2, 0 }, { 0, -1, .2, 0 }, { 0, 1, .2, 0 } };
+inline double blurKernel(double a, double b){ return a; }
 
-            sky = 1;
-            gSkyBlue.render(0, 0);
-            sky = 0;
-            clearAll = false;
-        }
+//Gradient direction takes central differences across and down, as a turn from 0 to 1
+const Tap GRADIENT_TAPS[] = { { 1, 0, .5, 0 }, { -1, 0, -.5, 0 }, { 0, 1, 0, .5 }, { 0, -1, 0, -.5 } };
+inline double gradientKernel(double a, double b){ return atan2(b, a) / (2 * M_PI) + .5; }
 
-        if (holding == true){
-            fade = 100;
-        }else{
-            if (fade > 0) fade -= 4;
-        }
-        if (delay > 0){ delay-=1; }
+#ifndef ERUPTION_KERNELS_ONLY
 
-        /*
-        if (fade > 0) {
-            int s = 200;
-            float a = 1.5;
-            SDL_Rect fillRect = {0, 0, 0, 0};
-            //top left
-            if (touchLocation.x < s*a && touchLocation.y > gScreenRect.h-s*2 && touchLocation.y < gScreenRect.h-s){
-                SDL_Rect f = {0, gScreenRect.h-s*2, s*a,s}; fillRect = f;
-                if (holding == true && delay <= 0){
-                    delay = 5;
-                }
-            }
-            //bottom left
-            if (touchLocation.x < s*a && touchLocation.y > gScreenRect.h-s){
-                SDL_Rect f = {0, gScreenRect.h-s, s*a,s}; fillRect = f;
-                if (holding == true && delay <= 0){
-                    delay = 5;
-                }
-            }
-            //top right
-            if (touchLocation.x > s*a && touchLocation.x < s*2*a && touchLocation.y > gScreenRect.h-s*2 && touchLocation.y < gScreenRect.h-s){
-                SDL_Rect f = {s*a, gScreenRect.h-s*2, s*a,s}; fillRect = f;
-                if (holding == true && delay <= 0){
-                    delay = 5;
-                }
-            }
-            //bottom right
-            if (touchLocation.x > s*a && touchLocation.x < s*2*a && touchLocation.y > gScreenRect.h-s){
-                SDL_Rect f = {s*a, gScreenRect.h-s, s*a,s}; fillRect = f;
-                if (holding == true && delay <= 0){
-                    delay = 5;
-                }
-            }
-            SDL_SetRenderDrawColor(gRenderer, 255,255,255, fade);
-            SDL_RenderFillRect(gRenderer, &fillRect);
-        }
-        */
+#ifdef BAKED_GENOME
+//The genome this viewer is built around, compiled by --compile
+#define ERUPTION_BAKING
+#include BAKED_GENOME
+#endif
 
-        //Draw Points
-        SDL_RenderSetScale( gRenderer, 4.0, 4.0);
+//Set to count and time every operator evalSpan applies, each thread into its scratch's profile
+bool gProfiling = false;
 
-        if (line_y < r_y) {
-            //for (double y = 0; y < r_x; y++) {
-            for (double y = line_y_old; y <= line_y; y++) {
-                for (double x = 0; x < r_y; x++) {
+//Set by --canonical: operator results are handed on through canonical and evaluating threads flush
+//subnormals, so a genome comes out the same everywhere. Off, evaluation is plain IEEE arithmetic
+bool gCanonical = false;
 
-                    frag_x = (x - r_x * .5) / (r_x * .5);
-                    frag_y = (y - r_y * .5) / (r_y * .5);
+/*
+ * What an operator result is handed on as in the current evaluation mode
+ */
+inline double handOn(double v){
+    return gCanonical ? canonical(v) : v;
+}
 
-                    color_num = 0; double r = getValue(root) * 255;
-                    color_num = 1; double g = getValue(root) * 255;
-                    color_num = 2; double b = getValue(root) * 255;
+/*
+ * In the --canonical mode, make this thread's floating point flush subnormal inputs and results to zero,
+ * so kernels passing through them never take the slow microcoded path. A blur or gradient of tiny values
+ * comes out differently with it, so every thread that evaluates calls it and they all draw the same picture.
+ * Left off while profiling, which is there to see the subnormals
+ */
+void flushSubnormals(){
+    if (!gCanonical || gProfiling){
+        return;
+    }
+#if defined(__SSE2__)
+    //FTZ and DAZ
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#elif defined(__aarch64__)
+    //FZ
+    uint64_t fpcr;
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1ULL << 24)));
+#elif defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+    //FZ
+    uint32_t fpscr;
+    __asm__ __volatile__("vmrs %0, fpscr" : "=r"(fpscr));
+    __asm__ __volatile__("vmsr fpscr, %0" : : "r"(fpscr | (1U << 24)));
+#endif
+}
 
-                    SDL_SetRenderDrawColor(gRenderer,
-                                           r,
-                                           g,
-                                           b,
-                                           255);
+//Range a value is known to lie in, infinite ends when nothing is known, not even that it is a number
+struct Interval{
+    double lo;
+    double hi;
+};
 
-                                                 //Resize value
-                    int tx = x + gScreenRect.w * (.25) * .5 - r_x * .5;
-                    int ty = y + gScreenRect.h * (.25) * .5 - r_y * .5;
-                    SDL_RenderDrawPoint(gRenderer, tx, ty);
+Interval makeInterval(double lo, double hi){
+    Interval result = { lo, hi };
+    return result;
+}
 
-                }
-            }
-        }
-        //Next line y-axis
-        line_y_old = line_y;
-        line_y += 1;
-        //if (line_y > r_y) {
-        //line_y = 0;
-        //}
+Interval unbounded(){
+    return makeInterval(-std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity());
+}
 
-        //SDL_RenderSetScale( gRenderer, 1.0, 1.0);
+bool isBounded(Interval a){
+    return a.lo >= -std::numeric_limits<double>::max() && a.hi <= std::numeric_limits<double>::max();
+}
 
-        //Full screen fade
-        SDL_Rect fillRect = {0,0, gScreenRect.w, gScreenRect.h};
-        SDL_SetRenderDrawColor(gRenderer, 0,0,0, 0);
-        SDL_RenderFillRect(gRenderer, &fillRect);
+//Kernels take the left and right child values, unary operators only read the right
+typedef double (*ScalarKernel)( double left, double right );
+typedef void (*SpanKernel)( const double* left, double* out, int count );
+typedef Interval (*BoundFunction)( Interval left, Interval right );
 
-        //Render primitives and Background
-        SDL_SetRenderTarget( gRenderer, NULL );
-        gTargetTexture.render( 0, 0 );
-        SDL_RenderSetScale( gRenderer, 1.0, 1.0);
+/*
+ * Span version of a scalar kernel, the right side and result in out. Inlining the kernel
+ * into one tight loop lets the compiler vectorize it, and keeps it exactly equal to the scalar one
+ */
+template< double (*Kernel)( double, double ) >
+void spanKernel( const double* left, double* out, int count ) {
+    for (int i = 0; i < count; i++) out[i] = Kernel(left[i], out[i]);
+}
 
 
+Interval addBound(Interval l, Interval r){ return makeInterval(l.lo + r.lo, l.hi + r.hi); }
+Interval subtractBound(Interval l, Interval r){ return makeInterval(l.lo - r.hi, l.hi - r.lo); }
+Interval multiplyBound(Interval l, Interval r){
+    if (!isBounded(l) || !isBounded(r)) return unbounded();
+    double p[4] = { l.lo * r.lo, l.lo * r.hi, l.hi * r.lo, l.hi * r.hi };
+    return makeInterval(*std::min_element(p, p + 4), *std::max_element(p, p + 4));
+}
+Interval divideBound(Interval l, Interval r){
+    if (r.lo <= 0 && r.hi >= 0) return unbounded();
+    return multiplyBound(l, makeInterval(1 / r.hi, 1 / r.lo));
+}
+Interval modBound(Interval l, Interval r){
+    if (r.lo <= 0 && r.hi >= 0) return unbounded();
+    double size = std::min(std::max(std::fabs(r.lo), std::fabs(r.hi)), std::max(std::fabs(l.lo), std::fabs(l.hi)));
+    return makeInterval(l.lo >= 0 ? 0 : -size, l.hi <= 0 ? 0 : size);
+}
+Interval minBound(Interval l, Interval r){ return makeInterval(std::min(l.lo, r.lo), std::min(l.hi, r.hi)); }
+Interval maxBound(Interval l, Interval r){ return makeInterval(std::max(l.lo, r.lo), std::max(l.hi, r.hi)); }
+Interval bitsBound(Interval l, Interval r){ return unbounded(); }
+Interval absBound(Interval l, Interval r){
+    if (r.lo >= 0) return r;
+    if (r.hi <= 0) return makeInterval(-r.hi, -r.lo);
+    return makeInterval(0, std::max(-r.lo, r.hi));
+}
+Interval roundBound(Interval l, Interval r){ return makeInterval(round(r.lo), round(r.hi)); }
+Interval exptBound(Interval l, Interval r){ return makeInterval(exp(r.lo), exp(r.hi)); }
+Interval logBound(Interval l, Interval r){ return r.lo > 0 ? makeInterval(log(r.lo), log(r.hi)) : unbounded(); }
+Interval waveBound(Interval l, Interval r){ return std::max(-r.lo, r.hi) < 1e300 ? makeInterval(0, 1) : unbounded(); }
+Interval atanBound(Interval l, Interval r){ return makeInterval(atan(r.lo * 12), atan(r.hi * 12)); }
+Interval noiseBound(Interval l, Interval r){ return makeInterval(0, 1); }
+Interval blurBound(Interval l, Interval r){
+    //An average of samples, give or take rounding
+    return makeInterval(r.lo - std::fabs(r.lo) * 1e-12, r.hi + std::fabs(r.hi) * 1e-12);
+}
 
-        //Debug Text
-        std::ostringstream temp;
-        std::ostringstream temp2;
-        std::ostringstream temp3, temp4;
-        recur(root);
-        for (int n = 0; n < v.size(); n++){
-            if (n < 25)
-                temp << v[n];
-            else if (n < 50)
-                temp2 << v[n];
-            else if (n < 75)
-                temp3 << v[n];
-            else
-                temp4 << v[n];
-        }
-        v.clear();
+//An operator: its name in genomes, which children it reads, how to evaluate and bound it,
+//and how often mutation picks it. Spatial operators also list the taps they sample.
+//Compiled genomes call the scalar kernel by its name
+struct Operator{
+    const char* name;
+    int arity;
+    ScalarKernel scalar;
+    SpanKernel span;
+    BoundFunction bound;
+    int weight;
+    const Tap* taps;
+    int tapCount;
+    const char* kernel;
+};
 
-        diff = clock() - start;
-        msec = diff * 1000 / CLOCKS_PER_SEC;
-        temp4 << " " << msec << " "; //<< getValue(root);
-        //Completed an Image
-        if (line_y > r_y){
-            temp4 << "Click...";
-        }
-        if (holding == 1 && delay <= 0) {
-            clearAll = true;
-            line_y = 0;
+//Every operator genomes can use, adding one here is all it takes
+const Operator OPERATORS[] = {
+    { "+", 2, addKernel, spanKernel<addKernel>, addBound, 2, NULL, 0, "addKernel" },
+    { "-", 2, subtractKernel, spanKernel<subtractKernel>, subtractBound, 2, NULL, 0, "subtractKernel" },
+    { "*", 2, multiplyKernel, spanKernel<multiplyKernel>, multiplyBound, 2, NULL, 0, "multiplyKernel" },
+    { "/", 2, divideKernel, spanKernel<divideKernel>, divideBound, 2, NULL, 0, "divideKernel" },
+    { "Mod", 2, modKernel, spanKernel<modKernel>, modBound, 2, NULL, 0, "modKernel" },
+    { "Min", 2, minKernel, spanKernel<minKernel>, minBound, 2, NULL, 0, "minKernel" },
+    { "Max", 2, maxKernel, spanKernel<maxKernel>, maxBound, 2, NULL, 0, "maxKernel" },
+    { "And", 2, andKernel, spanKernel<andKernel>, bitsBound, 2, NULL, 0, "andKernel" },
+    { "Or", 2, orKernel, spanKernel<orKernel>, bitsBound, 2, NULL, 0, "orKernel" },
+    { "Xor", 2, xorKernel, spanKernel<xorKernel>, bitsBound, 2, NULL, 0, "xorKernel" },
+    { "Abs", 1, absKernel, spanKernel<absKernel>, absBound, 2, NULL, 0, "absKernel" },
+    { "Round", 1, roundKernel, spanKernel<roundKernel>, roundBound, 2, NULL, 0, "roundKernel" },
+    { "Expt", 1, exptKernel, spanKernel<exptKernel>, exptBound, 2, NULL, 0, "exptKernel" },
+    { "Log", 1, logKernel, spanKernel<logKernel>, logBound, 2, NULL, 0, "logKernel" },
+    { "Sin", 1, sinKernel, spanKernel<sinKernel>, waveBound, 2, NULL, 0, "sinKernel" },
+    { "Cos", 1, cosKernel, spanKernel<cosKernel>, waveBound, 2, NULL, 0, "cosKernel" },
+    { "aTan", 1, atanKernel, spanKernel<atanKernel>, atanBound, 2, NULL, 0, "atanKernel" },
+    { "Invert", 1, invertKernel, spanKernel<invertKernel>, bitsBound, 2, NULL, 0, "invertKernel" },
+    { "Noise", 2, noiseKernel, spanKernel<noiseKernel>, noiseBound, 2, NULL, 0, "noiseKernel" },
+    { "Warp", 2, warpKernel, spanKernel<warpKernel>, noiseBound, 1, NULL, 0, "warpKernel" },
+    { "Blur", 2, blurKernel, spanKernel<blurKernel>, blurBound, 1, BLUR_TAPS, 5, "blurKernel" },
+    { "Grad", 2, gradientKernel, spanKernel<gradientKernel>, noiseBound, 1, GRADIENT_TAPS, 4, "gradientKernel" },
+};
+const int OPERATOR_COUNT = sizeof(OPERATORS) / sizeof(OPERATORS[0]);
 
-            if (touchLocation.y < gScreenRect.h / 4.0){
-                deleteTree(root);
-                root = new Node(0);
-            }else {
+int findOperator(const std::string& name){
+    for (int n = 0; n < OPERATOR_COUNT; n++){
+        if (name == OPERATORS[n].name) return n;
+    }
+    return -1;
+}
 
-                while (true) {
-                    auto save_root = root;
-                    mutateExpression(root, 0);
-
-                    //Compare if all corners of image are the same to avoid boring 1-color art
-                    int strikes = 0;
-                    for (int n = 0; n < 3; n++) {
-                        color_num = n;
-                        frag_x = 0;
-                        frag_y = 0;
-                        double compare1 = getValue(root) * 255;
-                        frag_x = 1;
-                        frag_y = 0;
-                        double compare2 = getValue(root) * 255;
-                        frag_x = 0;
-                        frag_y = 1;
-                        double compare3 = getValue(root) * 255;
-                        frag_x = 1;
-                        frag_y = 1;
-                        double compare4 = getValue(root) * 255;
-                        if (compare1 == compare2 == compare3 == compare4) {
-                            strikes += 1;
-                        }
-                    }
-                    if (strikes == 3) {
-                        temp4 << strikes;
-                        deleteTree(root);
-                        root = save_root;
-                        continue;
+//Variables genomes can read: the point, and T for the time through an animation, 0 in still images
+const char* const VARIABLES[] = { "X", "Y", "T" };
+const int VARIABLE_COUNT = sizeof(VARIABLES) / sizeof(VARIABLES[0]);
+
+int findVariable(const std::string& name){
+    for (int n = 0; n < VARIABLE_COUNT; n++){
+        if (name == VARIABLES[n]) return n;
+    }
+    return -1;
+}
+
+std::bitset<sizeof(double) * CHAR_BIT> message;
+std::string messages;
+
+
+/*
+ * Calculate Equation at a point and time, only reads the tree so render threads can share it
+ */
+double evalNode( Node *node, double x, double y, int channel, double t = 0 ) {
+
+    if ( node->kind == NUMBER ) {
+        return handOn(node->number);
+    }
+
+    if ( node->kind == VECTOR ) {
+        if (channel == 0){ return evalNode(node->r, x, y, channel, t); }
+        if (channel == 1){ return evalNode(node->g, x, y, channel, t); }
+        return evalNode(node->b, x, y, channel, t);
+    }
+
+    if ( node->kind == VARIABLE ) {
+        if ( node->code == 0 ){
+            return x;
+        }
+        if ( node->code == 1 ){
+            return y;
+        }
+        if ( node->code == 2 ){
+            return t;
+        }
+    }
+
+    //Unknown operators evaluate their children and give 0
+    const Operator* op = node->kind == OPERATOR && node->code >= 0 ? &OPERATORS[node->code] : NULL;
+    double leftVal = 0, rightVal = 0;
+    if (node->left != NULL && (op == NULL || op->arity == 2)) {
+        leftVal = evalNode(node->left, x, y, channel, t);
+    }
+    if (op != NULL && op->taps != NULL) {
+        double radius = spatialRadius(leftVal);
+        double a = 0, b = 0;
+        for (int k = 0; k < op->tapCount; k++){
+            double sample = node->right != NULL ? evalNode(node->right, x + op->taps[k].dx * radius, y + op->taps[k].dy * radius, channel, t) : 0;
+            a += op->taps[k].a * sample;
+            b += op->taps[k].b * sample;
+        }
+        return handOn(op->scalar(a, b));
+    }
+    if (node->right != NULL) {
+        rightVal = evalNode(node->right, x, y, channel, t);
+    }
+
+    if (op == NULL) return 0;
+    return handOn(op->scalar(leftVal, rightVal));
+}
+
+/*
+ * Bound the values a tree can take for points in a box, for ruling things out without rendering
+ */
+Interval boundNode( Node *node, Interval x, Interval y, int channel ) {
+
+    if ( node == NULL ) {
+        return makeInterval(0, 0);
+    }
+
+    if ( node->kind == NUMBER ) {
+        double value = handOn(node->number);
+        return value == value ? makeInterval(value, value) : unbounded();
+    }
+
+    if ( node->kind == VECTOR ) {
+        if (channel == 0){ return boundNode(node->r, x, y, channel); }
+        if (channel == 1){ return boundNode(node->g, x, y, channel); }
+        return boundNode(node->b, x, y, channel);
+    }
+
+    if ( node->kind == VARIABLE ) {
+        if ( node->code == 0 ) return x;
+        if ( node->code == 1 ) return y;
+        //T, which is 0 in still images
+        return makeInterval(0, 0);
+    }
+
+    if ( node->code < 0 ) {
+        return makeInterval(0, 0);
+    }
+    const Operator& op = OPERATORS[node->code];
+    Interval left = op.arity == 2 ? boundNode(node->left, x, y, channel) : makeInterval(0, 0);
+
+    //Spatial operators see a little beyond the box
+    Interval right;
+    if (op.taps != NULL) {
+        Interval wideX = makeInterval(x.lo - SPATIAL_RADIUS, x.hi + SPATIAL_RADIUS);
+        Interval wideY = makeInterval(y.lo - SPATIAL_RADIUS, y.hi + SPATIAL_RADIUS);
+        right = boundNode(node->right, wideX, wideY, channel);
+    }else{
+        right = boundNode(node->right, x, y, channel);
+    }
+
+    //Unbounded means anything at all, NaN included, and anything can come out of it
+    if (!isBounded(left) || !isBounded(right)) {
+        return unbounded();
+    }
+
+    //Constant inputs give a constant, worked out exactly
+    if (op.taps == NULL && left.lo == left.hi && right.lo == right.hi) {
+        double value = handOn(op.scalar(left.lo, right.lo));
+        return value == value ? makeInterval(value, value) : unbounded();
+    }
+    Interval result = op.bound(left, right);
+    if (!(result.lo <= result.hi)) {
+        return unbounded();
+    }
+
+    //Subnormal results and -0 are handed on as 0 in the --canonical mode
+    if (gCanonical && result.lo >= 0 && result.lo < std::numeric_limits<double>::min()) result.lo = 0;
+    if (gCanonical && result.hi <= 0 && result.hi > -std::numeric_limits<double>::min()) result.hi = 0;
+    return result;
+}
+
+/*
+ * Calculate Equation at the current fragment and color
+ */
+double getValue( Node *node ) {
+    return evalNode(node, frag_x, frag_y, color_num);
+}
+
+//The profiler counts each registered operator, plus one more for operators it doesn't know
+const int PROFILED_OP_COUNT = OPERATOR_COUNT + 1;
+
+//About one operator application in this many is timed, at random so no operator is always skipped
+const int PROFILE_SAMPLE_RATE = 16;
+
+//How often an operator or tree depth was evaluated, sampled time it took, and what came out
+struct OpStats{
+    Uint64 evals;
+    Uint64 sampledEvals;
+    Uint64 sampledTicks;
+    Uint64 nans;
+    Uint64 infs;
+    Uint64 subnormals;
+};
+
+//Evaluation profile by operator and by tree depth, kept per thread and added up
+struct OpProfile{
+
+    OpStats ops[PROFILED_OP_COUNT];
+    std::vector<OpStats> depths;
+    Uint64 sampler;
+
+    OpProfile() {
+        clear();
+        sampler = 0x9E3779B97F4A7C15ULL;
+    }
+
+    void clear() {
+        memset(ops, 0, sizeof(ops));
+        depths.clear();
+    }
+
+    void add( const OpProfile& other ) {
+        if (depths.size() < other.depths.size()) depths.resize(other.depths.size(), OpStats());
+        for (int n = 0; n < PROFILED_OP_COUNT; n++) addStats(ops[n], other.ops[n]);
+        for (size_t n = 0; n < other.depths.size(); n++) addStats(depths[n], other.depths[n]);
+    }
+
+    static void addStats( OpStats& to, const OpStats& from ) {
+        to.evals += from.evals;
+        to.sampledEvals += from.sampledEvals;
+        to.sampledTicks += from.sampledTicks;
+        to.nans += from.nans;
+        to.infs += from.infs;
+        to.subnormals += from.subnormals;
+    }
+
+};
+
+//Scratch rows for evalSpan, one per tree level so evaluating a span never allocates
+struct SpanScratch{
+
+    std::vector< std::vector<double> > levels;
+    std::vector<double> xs;
+    std::vector<double> ys;
+    std::vector<double> r;
+    std::vector<double> g;
+    std::vector<double> b;
+    std::vector<Uint32> packed;
+    std::vector<Uint32> apron;
+    std::vector<Uint64> edges;
+    std::vector< std::vector<double> > spatials;
+
+    //Time T reads, and the current row of each still subtree's three channels while rendering an animation
+    double time;
+    std::vector<const double*> stills;
+
+    //This thread's evaluations while gProfiling is set, see flushProfile
+    OpProfile profile;
+
+    //Operator results evalSpan worked out, and how many were NaN or infinite as the operator gave them
+    Uint64 applied;
+    Uint64 broken;
+
+    SpanScratch() {
+        time = 0;
+        applied = 0;
+        broken = 0;
+    }
+
+    double* level( int depth, int count ) {
+        if (depth >= levels.size()) levels.resize(depth + 1);
+        if (levels[depth].size() < count) levels[depth].resize(count);
+        return &levels[depth][0];
+    }
+
+    //Rows spatial operators at a tree level keep their offset points and sums in, which 0-3
+    double* spatial( int depth, int which, int count ) {
+        size_t row = (size_t)depth * 4 + which;
+        if (row >= spatials.size()) spatials.resize(row + 1);
+        if (spatials[row].size() < count) spatials[row].resize(count);
+        return &spatials[row][0];
+    }
+
+};
+
+/*
+ * Apply an operator to a span, left side from left and right side from out, result into out
+ */
+void applyOp( int code, const double* left, double* out, int count ) {
+    if (code < 0){
+        std::fill(out, out + count, 0.0);
+        return;
+    }
+    OPERATORS[code].span(left, out, count);
+}
+
+//Profiles flushed from every thread
+OpProfile gProfile;
+SDL_SpinLock gProfileLock = 0;
+
+/*
+ * Apply an operator like applyOp, recording it in a profile: every evaluation is counted
+ * and classified, about one application in PROFILE_SAMPLE_RATE is timed
+ */
+void profileOp( int code, const double* left, double* out, int count, int depth, OpProfile& profile ) {
+    int op = code >= 0 ? code : OPERATOR_COUNT;
+    if (depth >= profile.depths.size()) profile.depths.resize(depth + 1, OpStats());
+
+    OpStats* stats[2] = { &profile.ops[op], &profile.depths[depth] };
+    profile.sampler = profile.sampler * 6364136223846793005ULL + 1442695040888963407ULL;
+    bool sampled = (profile.sampler >> 33) % PROFILE_SAMPLE_RATE == 0;
+    Uint64 start = sampled ? SDL_GetPerformanceCounter() : 0;
+    applyOp(code, left, out, count);
+    Uint64 ticks = sampled ? SDL_GetPerformanceCounter() - start : 0;
+
+    int nans = 0, infs = 0, subnormals = 0;
+    for (int i = 0; i < count; i++){
+        int kind = std::fpclassify(out[i]);
+        nans += kind == FP_NAN;
+        infs += kind == FP_INFINITE;
+        subnormals += kind == FP_SUBNORMAL;
+    }
+    for (int n = 0; n < 2; n++){
+        stats[n]->evals += count;
+        stats[n]->nans += nans;
+        stats[n]->infs += infs;
+        stats[n]->subnormals += subnormals;
+        if (sampled){
+            stats[n]->sampledEvals += count;
+            stats[n]->sampledTicks += ticks;
+        }
+    }
+}
+
+/*
+ * Add a thread's profile to gProfile and start it over
+ */
+void flushProfile(SpanScratch& scratch){
+    if (!gProfiling){
+        return;
+    }
+    SDL_AtomicLock(&gProfileLock);
+    gProfile.add(scratch.profile);
+    SDL_AtomicUnlock(&gProfileLock);
+    scratch.profile.clear();
+}
+
+void printStatsRow(FILE* out, const char* name, const OpStats& stats, double totalSeconds){
+    double nanos = stats.sampledEvals > 0 ? (double)stats.sampledTicks / SDL_GetPerformanceFrequency() * 1e9 / stats.sampledEvals : 0;
+    double seconds = nanos * stats.evals / 1e9;
+    fprintf(out, "  %-8s %14llu %9.2f %9.1f %6.1f%% %12llu %12llu %12llu\n", name, (unsigned long long)stats.evals, nanos, seconds * 1000,
+           totalSeconds > 0 ? 100 * seconds / totalSeconds : 0, (unsigned long long)stats.nans, (unsigned long long)stats.infs,
+           (unsigned long long)stats.subnormals);
+}
+
+/*
+ * Print a profile as tables by operator, slowest in total first, and by tree depth
+ */
+void printProfile(const OpProfile& profile, FILE* out = stdout){
+    double total = 0;
+    std::vector< std::pair<double, int> > order;
+    for (int n = 0; n < PROFILED_OP_COUNT; n++){
+        const OpStats& stats = profile.ops[n];
+        double seconds = stats.sampledEvals > 0 ? (double)stats.sampledTicks / SDL_GetPerformanceFrequency() * stats.evals / stats.sampledEvals : 0;
+        total += seconds;
+        if (stats.evals > 0) order.push_back(std::make_pair(-seconds, n));
+    }
+    std::sort(order.begin(), order.end());
+
+    fprintf(out, "  %-8s %14s %9s %9s %7s %12s %12s %12s\n", "op", "evals", "ns/eval", "est ms", "share", "NaN", "Inf", "subnormal");
+    for (size_t n = 0; n < order.size(); n++){
+        int op = order[n].second;
+        printStatsRow(out, op < OPERATOR_COUNT ? OPERATORS[op].name : "other", profile.ops[op], total);
+    }
+    fprintf(out, "  %-8s %14s %9s %9s %7s %12s %12s %12s\n", "depth", "evals", "ns/eval", "est ms", "share", "NaN", "Inf", "subnormal");
+    for (size_t n = 0; n < profile.depths.size(); n++){
+        char name[16];
+        snprintf(name, sizeof(name), "%d", (int)n);
+        printStatsRow(out, name, profile.depths[n], total);
+    }
+}
+
+//Span of a genome compiled by --compile: channel 0-2 of count points at time t into out
+typedef void (*BakedSpan)( const double* x, const double* y, int count, int channel, double t, double* out );
+
+//A genome compiled to native code, built into the viewer or loaded with --kernel.
+//evalSpan hands this very tree to span instead of interpreting it, in the mode it was compiled for
+struct BakedGenome{
+    Node* genome;
+    BakedSpan span;
+    bool canonical;
+    void* library;
+};
+
+BakedGenome gBaked = { NULL, NULL, false, NULL };
+
+/*
+ * Calculate Equation over a span of points at once. Each operator is resolved once
+ * per span and applied in a tight loop, same results as evalNode point by point.
+ */
+void evalSpan( Node *node, const double* x, const double* y, int count, int channel, double* out, SpanScratch& scratch, int depth = 0 ) {
+
+    //The compiled genome runs natively, except while profiling, which needs every operator interpreted to see them
+    if ( node == gBaked.genome && !gProfiling && gBaked.canonical == gCanonical ) {
+        gBaked.span(x, y, count, channel, scratch.time, out);
+        scratch.applied += count;
+        scratch.broken += canonicalize(out, count, gCanonical);
+        return;
+    }
+
+    if ( node->kind == NUMBER ) {
+        std::fill(out, out + count, handOn(node->number));
+        return;
+    }
+
+    if ( node->kind == VECTOR ) {
+        if (channel == 0){ evalSpan(node->r, x, y, count, channel, out, scratch, depth); return; }
+        if (channel == 1){ evalSpan(node->g, x, y, count, channel, out, scratch, depth); return; }
+        evalSpan(node->b, x, y, count, channel, out, scratch, depth);
+        return;
+    }
+
+    if ( node->kind == VARIABLE ) {
+        if ( node->code == 0 ){
+            std::copy(x, x + count, out);
+            return;
+        }
+        if ( node->code == 1 ){
+            std::copy(y, y + count, out);
+            return;
+        }
+        if ( node->code == 2 ){
+            std::fill(out, out + count, scratch.time);
+            return;
+        }
+        //Subtrees an animation rendered once, see findStills
+        if ( node->code >= VARIABLE_COUNT && node->code - VARIABLE_COUNT < scratch.stills.size() / 3 ) {
+            const double* row = scratch.stills[(node->code - VARIABLE_COUNT) * 3 + channel];
+            std::copy(row, row + count, out);
+            return;
+        }
+    }
+
+    //Left side goes into this level's scratch row, right side straight into out
+    const Operator* op = node->kind == OPERATOR && node->code >= 0 ? &OPERATORS[node->code] : NULL;
+    double* left = scratch.level(depth, count);
+    if (node->left != NULL && (op == NULL || op->arity == 2)) {
+        evalSpan(node->left, x, y, count, channel, left, scratch, depth + 1);
+    }else{
+        std::fill(left, left + count, 0.0);
+    }
+
+    //Spatial operators evaluate the right side once per tap at offset points and sum the taps
+    if (op != NULL && op->taps != NULL) {
+        double* sx = scratch.spatial(depth, 0, count);
+        double* sy = scratch.spatial(depth, 1, count);
+        double* a = scratch.spatial(depth, 2, count);
+        double* b = scratch.spatial(depth, 3, count);
+        std::fill(a, a + count, 0.0);
+        std::fill(b, b + count, 0.0);
+        for (int k = 0; k < op->tapCount; k++){
+            const Tap& tap = op->taps[k];
+            for (int i = 0; i < count; i++){
+                double radius = spatialRadius(left[i]);
+                sx[i] = x[i] + tap.dx * radius;
+                sy[i] = y[i] + tap.dy * radius;
+            }
+            if (node->right != NULL) {
+                evalSpan(node->right, sx, sy, count, channel, out, scratch, depth + 1);
+            }else{
+                std::fill(out, out + count, 0.0);
+            }
+            for (int i = 0; i < count; i++){
+                a[i] += tap.a * out[i];
+                b[i] += tap.b * out[i];
+            }
+        }
+        std::copy(b, b + count, out);
+        left = a;
+    }else if (node->right != NULL) {
+        evalSpan(node->right, x, y, count, channel, out, scratch, depth + 1);
+    }else{
+        std::fill(out, out + count, 0.0);
+    }
+
+    if (gProfiling){
+        profileOp(node->kind == OPERATOR ? node->code : -1, left, out, count, depth, scratch.profile);
+    }else{
+        applyOp(node->kind == OPERATOR ? node->code : -1, left, out, count);
+    }
+    scratch.applied += count;
+    scratch.broken += canonicalize(out, count, gCanonical);
+}
+
+//Independent random stream, so mutations can be drawn without disturbing rand()
+struct RandomStream{
+
+    Uint64 state;
+
+    RandomStream( Uint64 seed ) {
+        state = seed != 0 ? seed : 0x9E3779B97F4A7C15ULL;
+    }
+
+    //Same range as rand()
+    int next(){
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (int)((state * 2685821657736338717ULL) >> 33);
+    }
+
+};
+
+int nextRand(RandomStream* rng){
+    if (rng != NULL) return rng->next();
+    return rand();
+}
+
+/*
+ * Pick an operator name, each as often as its weight in OPERATORS
+ */
+std::string randomOp(RandomStream* rng = NULL){
+    int total = 0;
+    for (int n = 0; n < OPERATOR_COUNT; n++) total += OPERATORS[n].weight;
+    int r = nextRand(rng) % total;
+    for (int n = 0; n < OPERATOR_COUNT; n++){
+        r -= OPERATORS[n].weight;
+        if (r < 0) return OPERATORS[n].name;
+    }
+    return "*";
+}
+
+/*
+ * DPS to mutate random operators into new types. Trees are never changed in place: a changed node
+ * is rebuilt along with the path above it, and everything left alone is shared with the original.
+ * Returns a new reference, for deleteTree
+ */
+Node* mutateExpression(Node *prev, int depth, RandomStream* rng = NULL){
+    current = prev;
+    if (depth > 4){
+        return copyTree(prev);
+    }
+
+    if (prev->kind == OPERATOR){
+        //Unary operators ignore their left side, so there's nothing to gain mutating it
+        bool unary = prev->code >= 0 && OPERATORS[prev->code].arity == 1;
+        Node* left;
+        Node* right;
+        if (prev->left != NULL){
+            left = unary ? copyTree(prev->left) : mutateExpression(prev->left, depth + 1, rng);
+        }else{
+            left = new Node(nextRand(rng) % 100 / 100.0);
+        }
+        if (prev->right != NULL){
+            right = mutateExpression(prev->right, depth + 1, rng);
+        }else{
+            right = new Node(nextRand(rng) % 100 / 100.0);
+        }
+        std::string op = prev->op;
+        int r = nextRand(rng) % 10;
+        if (r <= 1) {
+            op = randomOp(rng);
+        }
+        if (left == prev->left && right == prev->right && op == prev->op){
+            deleteTree(left);
+            deleteTree(right);
+            return copyTree(prev);
+        }
+        return new Node(op, left, right);
+    }
+
+    //The replacement built so far, NULL while prev itself still stands
+    Node* changed = NULL;
+
+    if (prev->kind == NUMBER && nextRand(rng)%2 == 0){
+        int r = nextRand(rng) % 10;
+        if (r <= 2){
+            double rgb_new[3] = {nextRand(rng) % 100 / 100.0, nextRand(rng) % 100 / 100.0, nextRand(rng) % 100 / 100.0};
+            return new Node(new Node(rgb_new[0]), new Node(rgb_new[1]), new Node(rgb_new[2]));
+        }else if (r <= 5){
+            int c = nextRand(rng) % 5;
+            if (c <= 1) return new Node("X", NULL);
+            if (c <= 3) return new Node("Y", NULL);
+            return new Node("T", NULL);
+        }
+        changed = new Node(nextRand(rng)%100/100.0);
+    }
+
+    if (prev->kind == VARIABLE && nextRand(rng)%2 == 0) {
+        int c = nextRand(rng) % 3;
+        if (c == 0) changed = new Node("X", NULL);
+        if (c == 1) changed = new Node("Y", NULL);
+        /*if (c == 2){
+            changed = new Node(randomOp(rng), copyTree(x_var), new Node(nextRand(rng)%100/100.0));
+        }*/
+    }
+
+    if (prev->kind == VECTOR && nextRand(rng)%2 == 0){
+        int r = nextRand(rng) % 10;
+        if (r <= 1){
+            return new Node(nextRand(rng)%100);
+        }else if (r <= 3){
+            Node* red = mutateExpression(prev->r, depth + 1, rng);
+            Node* green = mutateExpression(prev->g, depth + 1, rng);
+            Node* blue = mutateExpression(prev->b, depth + 1, rng);
+            return new Node(red, green, blue);
+        }
+    }
+
+    int r = nextRand(rng) % 10;
+    if (r <= 2) {
+        Node* left = new Node(nextRand(rng)%100 / 100.0);
+        Node* right = new Node(nextRand(rng)%100 / 100.0);
+        if (changed != NULL) deleteTree(changed);
+        return new Node(randomOp(rng), left, right);
+    }
+
+    return changed != NULL ? changed : copyTree(prev);
+}
+
+
+//Where the single image looks in the function domain: center and half its width
+struct View{
+    double x;
+    double y;
+    double scale;
+};
+
+const View DEFAULT_VIEW = { 0, 0, 1 };
+
+/*
+ * One channel of a color times 255 as 8 bits: truncated towards zero and wrapped around,
+ * and anything beyond the range of an int, or NaN, as 0. That is what x86 always made of the
+ * plain cast, now spelled out so every platform agrees
+ */
+inline Uint32 packChannel(double v){
+    double inRange = std::fabs(v) < 2147483648.0 ? v : 0.0;
+    return (Uint8)(Sint32)inRange;
+}
+
+/*
+ * Pack a color computed by the genome into an RGBA8888 pixel
+ */
+Uint32 packPixel(double r, double g, double b){
+    return (packChannel(r) << 24) | (packChannel(g) << 16) | (packChannel(b) << 8) | 0xFF;
+}
+
+/*
+ * Whether the genome's bounds prove every pixel in the view packs to one color, without rendering it
+ */
+bool isFlat(Node* genome, View view){
+    Interval x = makeInterval(view.x - view.scale, view.x + view.scale);
+    Interval y = makeInterval(view.y - view.scale, view.y + view.scale);
+    for (int channel = 0; channel < 3; channel++){
+        Interval bound = boundNode(genome, x, y, channel);
+        if (!(bound.lo >= 0 && bound.hi * 255 < 256) || (int)(bound.lo * 255) != (int)(bound.hi * 255)){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Render count samples of a genome along a row whose column 0 sits at left, one every dx,
+ * at columns first, first + stride, ... so a column gets the same x whichever span it is in
+ */
+void renderSpan(Node* genome, double left, double dx, int first, int stride, double y, int count, Uint32* out, SpanScratch& scratch){
+    scratch.xs.resize(count);
+    scratch.ys.resize(count);
+    scratch.r.resize(count);
+    scratch.g.resize(count);
+    scratch.b.resize(count);
+    for (int i = 0; i < count; i++){
+        scratch.xs[i] = left + (first + i * stride) * dx;
+        scratch.ys[i] = y;
+    }
+
+    evalSpan(genome, &scratch.xs[0], &scratch.ys[0], count, 0, &scratch.r[0], scratch);
+    evalSpan(genome, &scratch.xs[0], &scratch.ys[0], count, 1, &scratch.g[0], scratch);
+    evalSpan(genome, &scratch.xs[0], &scratch.ys[0], count, 2, &scratch.b[0], scratch);
+
+    for (int i = 0; i < count; i++){
+        out[i] = packPixel(scratch.r[i] * 255, scratch.g[i] * 255, scratch.b[i] * 255);
+    }
+}
+
+/*
+ * Render a region of a width x height image of the genome seen through a view
+ */
+void renderRegion(Node* genome, int width, int height, View view, SDL_Rect region, Uint32* out, int pitch, SpanScratch& scratch){
+    double half_w = width * .5;
+    double half_h = height * .5;
+    double left = view.x - view.scale;
+    double dx = view.scale / half_w;
+    for (int y = 0; y < region.h; y++){
+        double fy = view.y + (region.y + y - half_h) / half_h * view.scale;
+        renderSpan(genome, left, dx, region.x, 1, fy, region.w, &out[(size_t)y * pitch], scratch);
+    }
+}
+
+
+//Adaptive anti-aliasing: pixels whose color jumps against a neighbour get extra jittered samples
+struct AntiAlias{
+    int samples;        //extra samples per refined pixel, 0 turns it off
+    int threshold;      //largest channel difference to a neighbour that is left alone
+    double budget;      //extra samples allowed per pixel on average
+};
+
+const AntiAlias NO_ANTI_ALIAS = { 0, 24, 1.0 };
+
+//Most samples a refined pixel takes, and so the most the budget can usefully be
+const int AA_MAX_SAMPLES = 256;
+
+//Samples evaluated per batch while refining, so scratch stays this size whatever the budget
+const int AA_BATCH = 4096;
+
+/*
+ * Whether anti-aliasing settings are in range, they come from the command line and the network
+ */
+bool checkAntiAlias(AntiAlias aa){
+    return aa.samples >= 0 && aa.samples <= AA_MAX_SAMPLES && aa.budget >= 0 && aa.budget <= AA_MAX_SAMPLES;
+}
+
+/*
+ * Largest channel difference between two RGBA8888 pixels
+ */
+int colorDistance(Uint32 a, Uint32 b){
+    int d = 0;
+    for (int shift = 8; shift <= 24; shift += 8){
+        d = std::max(d, abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF)));
+    }
+    return d;
+}
+
+/*
+ * Jitter in [0,1) that only depends on the pixel and sample, so tiles render the same anywhere
+ */
+double jitter(int x, int y, int sample){
+    Uint64 z = ((Uint64)(Uint32)x << 32 | (Uint32)y) * 0x9E3779B97F4A7C15ULL + sample * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Render a region like renderRegion, then supersample only the pixels on edges,
+ * the most contrasting first until the sample budget runs out. Returns pixels refined.
+ */
+int renderRegionAA(Node* genome, int width, int height, View view, SDL_Rect region, Uint32* out, int pitch, AntiAlias aa, SpanScratch& scratch){
+    if (aa.samples <= 0){
+        renderRegion(genome, width, height, view, region, out, pitch, scratch);
+        return 0;
+    }
+
+    //Render with a one pixel apron so edges along the region's border are seen too
+    int x0 = std::max(0, region.x - 1);
+    int y0 = std::max(0, region.y - 1);
+    int x1 = std::min(width, region.x + region.w + 1);
+    int y1 = std::min(height, region.y + region.h + 1);
+    SDL_Rect apronRect = { x0, y0, x1 - x0, y1 - y0 };
+    scratch.apron.resize(apronRect.w * apronRect.h);
+    renderRegion(genome, width, height, view, apronRect, &scratch.apron[0], apronRect.w, scratch);
+
+    //Find edge pixels, keyed by contrast so the sharpest edges win the budget
+    scratch.edges.clear();
+    for (int y = region.y; y < region.y + region.h; y++){
+        for (int x = region.x; x < region.x + region.w; x++){
+            int i = (y - y0) * apronRect.w + (x - x0);
+            Uint32 p = scratch.apron[i];
+            int contrast = 0;
+            if (x > x0) contrast = std::max(contrast, colorDistance(p, scratch.apron[i - 1]));
+            if (x < x1 - 1) contrast = std::max(contrast, colorDistance(p, scratch.apron[i + 1]));
+            if (y > y0) contrast = std::max(contrast, colorDistance(p, scratch.apron[i - apronRect.w]));
+            if (y < y1 - 1) contrast = std::max(contrast, colorDistance(p, scratch.apron[i + apronRect.w]));
+            if (contrast > aa.threshold){
+                scratch.edges.push_back((Uint64)(255 - contrast) << 32 | (Uint32)i);
+            }
+        }
+    }
+    //Jobs also arrive from coordinators, so clamp rather than trust the budget
+    double allowed = aa.budget * region.w * region.h / aa.samples;
+    size_t limit = allowed > 0 ? (size_t)std::min(allowed, (double)scratch.edges.size()) : 0;
+    if (scratch.edges.size() > limit){
+        std::nth_element(scratch.edges.begin(), scratch.edges.begin() + limit, scratch.edges.end());
+        scratch.edges.resize(limit);
+    }
+    int refined = scratch.edges.size();
+
+    //Stratified jittered positions inside each refined pixel, evaluated a batch of pixels at a time
+    int grid = ceil(sqrt((double)aa.samples));
+    int batch = std::max(1, AA_BATCH / aa.samples);
+    std::vector<double>& xs = scratch.xs;
+    std::vector<double>& ys = scratch.ys;
+    double half_w = width * .5;
+    double half_h = height * .5;
+    scratch.packed.resize(refined);
+    for (int first = 0; first < refined; first += batch){
+        int pixels = std::min(batch, refined - first);
+        int count = pixels * aa.samples;
+        xs.resize(count);
+        ys.resize(count);
+        for (int k = 0; k < pixels; k++){
+            int i = (Uint32)scratch.edges[first + k];
+            int x = x0 + i % apronRect.w;
+            int y = y0 + i / apronRect.w;
+            for (int s = 0; s < aa.samples; s++){
+                double px = x + ((s % grid) + jitter(x, y, s * 2)) / grid - .5;
+                double py = y + ((s / grid) + jitter(x, y, s * 2 + 1)) / grid - .5;
+                xs[k * aa.samples + s] = view.x + (px - half_w) / half_w * view.scale;
+                ys[k * aa.samples + s] = view.y + (py - half_h) / half_h * view.scale;
+            }
+        }
+
+        scratch.r.resize(count);
+        scratch.g.resize(count);
+        scratch.b.resize(count);
+        evalSpan(genome, &xs[0], &ys[0], count, 0, &scratch.r[0], scratch);
+        evalSpan(genome, &xs[0], &ys[0], count, 1, &scratch.g[0], scratch);
+        evalSpan(genome, &xs[0], &ys[0], count, 2, &scratch.b[0], scratch);
+
+        //Average what each sample would have shown together with the first pass
+        for (int k = 0; k < pixels; k++){
+            Uint32 p = scratch.apron[(Uint32)scratch.edges[first + k]];
+            int sum[3] = { (int)(p >> 24), (int)((p >> 16) & 0xFF), (int)((p >> 8) & 0xFF) };
+            for (int s = 0; s < aa.samples; s++){
+                Uint32 q = packPixel(scratch.r[k * aa.samples + s] * 255, scratch.g[k * aa.samples + s] * 255, scratch.b[k * aa.samples + s] * 255);
+                sum[0] += q >> 24;
+                sum[1] += (q >> 16) & 0xFF;
+                sum[2] += (q >> 8) & 0xFF;
+            }
+            int n = aa.samples + 1;
+            scratch.packed[first + k] = (Uint32)((sum[0] + n / 2) / n) << 24 | (Uint32)((sum[1] + n / 2) / n) << 16 | (Uint32)((sum[2] + n / 2) / n) << 8 | 0xFF;
+        }
+    }
+    for (int k = 0; k < refined; k++){
+        scratch.apron[(Uint32)scratch.edges[k]] = scratch.packed[k];
+    }
+
+    for (int y = 0; y < region.h; y++){
+        memcpy(&out[(size_t)y * pitch], &scratch.apron[(region.y + y - y0) * apronRect.w + (region.x - x0)], region.w * sizeof(Uint32));
+    }
+    return refined;
+}
+
+//Fingerprints are taken from a thumbnail this size, keeping its lowest 8x8 frequencies
+const int FINGERPRINT_SIZE = 32;
+
+//Images whose fingerprints differ in at most this many bits look the same
+const int DUPLICATE_DISTANCE = 8;
+
+/*
+ * Perceptual fingerprint of a genome: the brightness of a 32x32 thumbnail through a DCT,
+ * one bit per low frequency telling whether it is above their median
+ */
+Uint64 fingerprint(Node* genome, View view, SpanScratch& scratch){
+    static double basis[8][FINGERPRINT_SIZE];
+    static bool ready = false;
+    if (!ready){
+        for (int u = 0; u < 8; u++){
+            for (int x = 0; x < FINGERPRINT_SIZE; x++){
+                basis[u][x] = cos(M_PI * (2 * x + 1) * u / (2.0 * FINGERPRINT_SIZE));
+            }
+        }
+        ready = true;
+    }
+
+    Uint32 pixels[FINGERPRINT_SIZE * FINGERPRINT_SIZE];
+    SDL_Rect whole = { 0, 0, FINGERPRINT_SIZE, FINGERPRINT_SIZE };
+    renderRegion(genome, FINGERPRINT_SIZE, FINGERPRINT_SIZE, view, whole, pixels, FINGERPRINT_SIZE, scratch);
+
+    //Rows first, then columns, only for the frequencies kept
+    double rows[FINGERPRINT_SIZE][8];
+    for (int y = 0; y < FINGERPRINT_SIZE; y++){
+        double luma[FINGERPRINT_SIZE];
+        for (int x = 0; x < FINGERPRINT_SIZE; x++){
+            Uint32 p = pixels[y * FINGERPRINT_SIZE + x];
+            luma[x] = .299 * (p >> 24) + .587 * ((p >> 16) & 0xFF) + .114 * ((p >> 8) & 0xFF);
+        }
+        for (int u = 0; u < 8; u++){
+            double sum = 0;
+            for (int x = 0; x < FINGERPRINT_SIZE; x++) sum += luma[x] * basis[u][x];
+            rows[y][u] = sum;
+        }
+    }
+    double coefficients[64];
+    for (int v = 0; v < 8; v++){
+        for (int u = 0; u < 8; u++){
+            double sum = 0;
+            for (int y = 0; y < FINGERPRINT_SIZE; y++) sum += rows[y][u] * basis[v][y];
+            coefficients[v * 8 + u] = sum;
+        }
+    }
+
+    //The median leaves out the average brightness, which says nothing about the pattern
+    double sorted[63];
+    memcpy(sorted, coefficients + 1, sizeof(sorted));
+    std::nth_element(sorted, sorted + 31, sorted + 63);
+    double median = sorted[31];
+
+    Uint64 hash = 0;
+    for (int n = 0; n < 64; n++){
+        if (coefficients[n] > median) hash |= 1ULL << n;
+    }
+    return hash;
+}
+
+//Candidates are screened on a grid of this many samples a side across the view, a batch at a time
+const int SCREEN_GRID = 16;
+const int SCREEN_BATCH = 128;
+
+//What the screening grid shows of a candidate over the three channels
+struct ScreenStats{
+    double variance;    //of each channel, colors from 0 to 1, averaged over the channels
+    double nans;        //operator results NaN or infinite, of all worked out for the grid
+    double clipped;     //outside 0 to 1, where packing wraps the color around
+    double frequency;   //average color change between neighbouring samples
+    double score;       //higher is better, 0 is not worth rendering
+};
+
+/*
+ * Evaluate a batch of genomes over the same sparse grid, each channel as one span of every sample,
+ * and score each on how much it varies, how much of it is broken, and how noisy it is
+ */
+void screenCandidates(const std::vector<Node*>& genomes, View view, std::vector<ScreenStats>& stats, SpanScratch& scratch){
+    const int samples = SCREEN_GRID * SCREEN_GRID;
+    scratch.xs.resize(samples);
+    scratch.ys.resize(samples);
+    scratch.r.resize(samples);
+    for (int y = 0; y < SCREEN_GRID; y++){
+        for (int x = 0; x < SCREEN_GRID; x++){
+            scratch.xs[y * SCREEN_GRID + x] = view.x + ((x + .5) / SCREEN_GRID * 2 - 1) * view.scale;
+            scratch.ys[y * SCREEN_GRID + x] = view.y + ((y + .5) / SCREEN_GRID * 2 - 1) * view.scale;
+        }
+    }
+
+    stats.resize(genomes.size());
+    for (int n = 0; n < genomes.size(); n++){
+        int clipped = 0;
+        scratch.applied = 0;
+        scratch.broken = 0;
+        double variance = 0, frequency = 0;
+        for (int channel = 0; channel < 3; channel++){
+            double* values = &scratch.r[0];
+            evalSpan(genomes[n], &scratch.xs[0], &scratch.ys[0], samples, channel, values, scratch);
+
+            double sum = 0, squares = 0;
+            for (int i = 0; i < samples; i++){
+                double v = values[i];
+                if (v < 0 || v * 255 >= 256){
+                    clipped++;
+                }
+                v = v < 0 ? 0 : v > 1 ? 1 : v;
+                values[i] = v;
+                sum += v;
+                squares += v * v;
+            }
+            double mean = sum / samples;
+            variance += std::max(squares / samples - mean * mean, 0.0);
+
+            double change = 0;
+            for (int y = 0; y < SCREEN_GRID; y++){
+                for (int x = 0; x + 1 < SCREEN_GRID; x++){
+                    change += fabs(values[y * SCREEN_GRID + x + 1] - values[y * SCREEN_GRID + x]);
+                    change += fabs(values[(x + 1) * SCREEN_GRID + y] - values[x * SCREEN_GRID + y]);
+                }
+            }
+            frequency += change / (2 * SCREEN_GRID * (SCREEN_GRID - 1));
+        }
+
+        ScreenStats& s = stats[n];
+        s.variance = variance / 3;
+        s.nans = scratch.applied > 0 ? (double)scratch.broken / scratch.applied : 0;
+        s.clipped = clipped / (3.0 * samples);
+        s.frequency = frequency / 3;
+
+        //Neighbours of unrelated random colors differ by about 1.13 deviations, art that changes that fast is static
+        double deviation = sqrt(s.variance);
+        double noise = deviation > 0 ? std::min(s.frequency / (1.13 * deviation), 1.0) : 0;
+        s.score = s.variance * 255 * 255 < 1 || s.nans > .5 ? 0 :
+                  deviation * (1 - s.nans) * (1 - .5 * s.clipped) * (1 - .5 * noise);
+    }
+}
+
+int hashDistance(Uint64 a, Uint64 b){
+    return __builtin_popcountll(a ^ b);
+}
+
+//Fingerprints are split into this many slices for searching
+const int HASH_SLICES = 5;
+
+//Fingerprints searchable by Hamming distance. Fingerprints within distance d agree to within
+//d/5 bits on at least one of five slices, so a search only reads the buckets of keys that
+//close to each of the query's slices. Buckets are kept sorted and contiguous, so each is one
+//sequential read; new fingerprints wait in a short list until there are enough to re-sort
+class HashIndex
+{
+public:
+
+    HashIndex();
+
+    //Adds a fingerprint
+    void insert( Uint64 hash );
+
+    //Whether a fingerprint within distance bits of hash was added
+    bool contains( Uint64 hash, int distance );
+
+    int getSize();
+
+    void clear();
+
+private:
+    //Sorts the waiting fingerprints into the slice tables
+    void rebuild();
+
+    //Key of a fingerprint in a slice table
+    int sliceKey( Uint64 hash, int slice );
+
+    //Checks the buckets of every key within flips bits of key, flipping bits from bit up
+    bool probe( int slice, Uint64 hash, int key, int flips, int bit, int distance );
+
+    std::vector<Uint64> mHashes;
+    std::vector<Uint64> mWaiting;
+
+    //Per slice, fingerprints ordered by key and where each key's bucket starts
+    std::vector<Uint64> mSorted[ HASH_SLICES ];
+    std::vector<int> mStarts[ HASH_SLICES ];
+};
+
+HashIndex::HashIndex()
+{
+    //Initialize
+    clear();
+}
+
+void HashIndex::insert( Uint64 hash )
+{
+    //Re-sorting costs the whole index, so wait for more fingerprints as it grows
+    mWaiting.push_back( hash );
+    if( mWaiting.size() >= std::max( 256.0, 8 * sqrt( (double)mHashes.size() ) ) )
+    {
+        rebuild();
+    }
+}
+
+bool HashIndex::contains( Uint64 hash, int distance )
+{
+    for( size_t i = 0; i < mWaiting.size(); ++i )
+    {
+        if( hashDistance( mWaiting[ i ], hash ) <= distance )
+        {
+            return true;
+        }
+    }
+    if( mHashes.empty() )
+    {
+        return false;
+    }
+    for( int slice = 0; slice < HASH_SLICES; ++slice )
+    {
+        if( probe( slice, hash, sliceKey( hash, slice ), distance / HASH_SLICES, 0, distance ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int HashIndex::getSize()
+{
+    return mHashes.size() + mWaiting.size();
+}
+
+void HashIndex::clear()
+{
+    mHashes.clear();
+    mWaiting.clear();
+    for( int slice = 0; slice < HASH_SLICES; ++slice )
+    {
+        mSorted[ slice ].clear();
+        mStarts[ slice ].clear();
+    }
+}
+
+void HashIndex::rebuild()
+{
+    mHashes.insert( mHashes.end(), mWaiting.begin(), mWaiting.end() );
+    mWaiting.clear();
+
+    //Counting sort by key
+    for( int slice = 0; slice < HASH_SLICES; ++slice )
+    {
+        int bits = ( slice + 1 ) * 64 / HASH_SLICES - slice * 64 / HASH_SLICES;
+        std::vector<int>& starts = mStarts[ slice ];
+        starts.assign( ( 1 << bits ) + 1, 0 );
+        for( size_t i = 0; i < mHashes.size(); ++i )
+        {
+            starts[ sliceKey( mHashes[ i ], slice ) + 1 ]++;
+        }
+        for( size_t key = 1; key < starts.size(); ++key )
+        {
+            starts[ key ] += starts[ key - 1 ];
+        }
+        std::vector<int> next( starts.begin(), starts.end() - 1 );
+        mSorted[ slice ].resize( mHashes.size() );
+        for( size_t i = 0; i < mHashes.size(); ++i )
+        {
+            mSorted[ slice ][ next[ sliceKey( mHashes[ i ], slice ) ]++ ] = mHashes[ i ];
+        }
+    }
+}
+
+int HashIndex::sliceKey( Uint64 hash, int slice )
+{
+    int first = slice * 64 / HASH_SLICES;
+    int bits = ( slice + 1 ) * 64 / HASH_SLICES - first;
+    return ( hash >> first ) & ( ( 1ULL << bits ) - 1 );
+}
+
+bool HashIndex::probe( int slice, Uint64 hash, int key, int flips, int bit, int distance )
+{
+    const std::vector<int>& starts = mStarts[ slice ];
+    const Uint64* sorted = &mSorted[ slice ][ 0 ];
+    for( int i = starts[ key ]; i < starts[ key + 1 ]; ++i )
+    {
+        if( hashDistance( sorted[ i ], hash ) <= distance )
+        {
+            return true;
+        }
+    }
+    if( flips == 0 )
+    {
+        return false;
+    }
+    int bits = ( slice + 1 ) * 64 / HASH_SLICES - slice * 64 / HASH_SLICES;
+    for( int b = bit; b < bits; ++b )
+    {
+        if( probe( slice, hash, key ^ ( 1 << b ), flips - 1, b + 1, distance ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//Children of root rendered ahead of the user's next tap
+const int SPECULATIVE_CANDIDATES = 4;
+
+//Framebuffers the pipeline cycles through: the render in flight, cancelled
+//renders whose workers have not finished their last row yet, and speculative renders
+const int RENDER_BUFFERS = 3 + SPECULATIVE_CANDIDATES;
+
+//Gallery thumbnails are refined over this many passes, each twice as fine as the last
+const int GALLERY_PASSES = 3;
+
+//Transparent border around each gallery thumbnail
+const int GALLERY_GUTTER = 1;
+
+//Zoomed renders are refined over this many passes, so a low-res preview lands first
+const int ZOOM_PASSES = 3;
+
+//One render into a CPU framebuffer, filled a row at a time by the workers. The
+//framebuffer is an atlas with a cell per genome, the main view being a single cell.
+struct RenderJob{
+
+    std::vector<Node*> genomes;
+    int columns;
+    int gutter;
+    int passes;
+    int width;
+    int height;
+    int cellWidth;
+    int cellHeight;
+    int serial;
+    Uint32 startTicks;
+
+    //Each cell maps its inner square onto this view
+    View view;
+
+    //Every pass has its own framebuffer so a row is never written twice. A unit is
+    //one row of samples of one pass, expanded into a block of rows of its framebuffer.
+    std::vector<Uint32> pixels;
+    std::vector<int> firstUnit;
+    std::vector<SDL_atomic_t> unitReady;
+
+    //Units that actually need rendering, and the columns of each row the final pass
+    //evaluates. A pan copies what is still visible and only leaves the exposed strips.
+    std::vector<int> todo;
+    std::vector<int> spanBegin;
+    std::vector<int> spanEnd;
+
+    //Shown until rows are ready, a blank texture when empty
+    std::vector<Uint32> preview;
+
+    //Finest pass uploaded for each row, only touched by the UI thread
+    std::vector<int> rowShown;
+
+    SDL_atomic_t nextUnit;
+    SDL_atomic_t unitsDone;
+    SDL_atomic_t cancelled;
+    SDL_atomic_t finishTicks;
+
+    //Workers inside the job and whether it is only a guess at the next tap,
+    //guarded by the pipeline mutex
+    int users;
+    bool speculative;
+
+    RenderJob() {
+        columns = 1;
+        gutter = 0;
+        passes = 1;
+        width = 0;
+        height = 0;
+        cellWidth = 0;
+        cellHeight = 0;
+        serial = 0;
+        startTicks = 0;
+        view = DEFAULT_VIEW;
+        users = 0;
+        speculative = false;
+        firstUnit.assign(2, 0);
+        SDL_AtomicSet(&nextUnit, 0);
+        SDL_AtomicSet(&unitsDone, 0);
+        SDL_AtomicSet(&cancelled, 0);
+        SDL_AtomicSet(&finishTicks, 0);
+    }
+
+    //Sample spacing of a pass
+    int getStep( int pass ) {
+        return 1 << (passes - 1 - pass);
+    }
+
+    int getUnits() {
+        return firstUnit[passes];
+    }
+
+    bool hasRowsLeft() {
+        return SDL_AtomicGet(&cancelled) == 0 && SDL_AtomicGet(&nextUnit) < todo.size();
+    }
+
+    //Row of the finest pass that has it ready, or NULL
+    Uint32* getReadyRow( int y ) {
+        for (int pass = passes - 1; pass >= 0; pass--){
+            if (SDL_AtomicGet(&unitReady[firstUnit[pass] + y / getStep(pass)]) != 0){
+                return &pixels[(pass * height + y) * width];
+            }
+        }
+        return NULL;
+    }
+
+    //Row of the final pass if it is ready, or NULL
+    Uint32* getFinalRow( int y ) {
+        if (SDL_AtomicGet(&unitReady[firstUnit[passes - 1] + y]) != 0){
+            return &pixels[((passes - 1) * height + y) * width];
+        }
+        return NULL;
+    }
+
+};
+
+/*
+ * Render one unit of a job: a row of samples across every cell, expanded into blocks
+ */
+void renderUnit(RenderJob* job, int unit, SpanScratch& scratch){
+    int pass = 0;
+    while (unit >= job->firstUnit[pass + 1]) pass++;
+
+    int step = job->getStep(pass);
+    int y = (unit - job->firstUnit[pass]) * step;
+    Uint32* buffer = &job->pixels[pass * job->width * job->height];
+
+    //Cells are a multiple of the coarsest step high, so a block never crosses into the next cell
+    int cellRow = y / job->cellHeight;
+    int ly = y - cellRow * job->cellHeight;
+    int innerWidth = job->cellWidth - job->gutter;
+    int innerHeight = job->cellHeight - job->gutter;
+    if (ly >= innerHeight){
+        return;
+    }
+    int rows = std::min(step, innerHeight - ly);
+
+    //The final pass only evaluates the columns a pan could not reuse
+    int begin = 0;
+    int end = innerWidth;
+    if (pass == job->passes - 1){
+        begin = job->spanBegin[y];
+        end = job->spanEnd[y];
+    }
+
+    //Each cell maps its inner square onto the view
+    double half_w = innerWidth * .5;
+    double half_h = innerHeight * .5;
+    double fy = job->view.y + (ly - half_h) / half_h * job->view.scale;
+    double left = job->view.x - job->view.scale;
+    int samples = (end - begin + step - 1) / step;
+    if (samples <= 0){
+        return;
+    }
+    scratch.packed.resize(samples);
+
+    for (int c = 0; c < job->columns; c++){
+        int index = cellRow * job->columns + c;
+        if (index >= job->genomes.size()){
+            break;
+        }
+
+        renderSpan(job->genomes[index], left, job->view.scale / half_w, begin, step, fy, samples, &scratch.packed[0], scratch);
+
+        int x0 = c * job->cellWidth;
+        for (int r = 0; r < rows; r++){
+            Uint32* out = &buffer[(y + r) * job->width + x0];
+            for (int x = begin; x < end; x++){
+                out[x] = scratch.packed[(x - begin) / step];
+            }
+        }
+    }
+}
+
+//Renders genomes on worker threads so the UI thread only polls events, uploads and presents
+class RenderPipeline
+{
+public:
+
+    RenderPipeline();
+    ~RenderPipeline();
+
+    //Starts the worker threads
+    bool init( int threads );
+
+    //Cancels the render in flight and starts rendering a copy of the genome
+    void start( Node* genome, int width, int height, View view = DEFAULT_VIEW );
+
+    //Moves the single image by whole pixels, keeping what is still visible and
+    //only rendering the exposed strips
+    bool pan( int dx, int dy );
+
+    //Scales the single image's view about a pixel, showing the old pixels stretched
+    //and then a low-res pass until the full render lands
+    bool zoom( double factor, int focusX, int focusY );
+
+    //View of the render in flight
+    View getView();
+
+    //Cancels the render in flight and starts rendering thumbnails of the genomes,
+    //coarse first and refined over GALLERY_PASSES passes
+    void startGallery( const std::vector<Node*>& genomes, int columns, int width, int height );
+
+    //Renders a copy of the genome in the background, returns the job's serial or -1
+    int speculate( Node* genome, int width, int height, View view = DEFAULT_VIEW );
+
+    //Makes a speculative render the one in flight, keeping the rows it already has
+    bool promote( int serial );
+
+    //Cancels every speculative render
+    void cancelSpeculative();
+
+    //Uploads rows finished since the last call into a streaming texture
+    int upload( LTexture& texture );
+
+    //Genome index of the cell under a framebuffer pixel, or -1
+    int getCellAt( int x, int y );
+
+    //Render progress
+    bool isComplete();
+    Uint32 getRenderTime();
+
+    //Stops the worker threads and frees the framebuffers
+    void free();
+
+private:
+    static int workerMain( void* data );
+    void workerLoop();
+    void renderRows( RenderJob* job, int foreground, SpanScratch& scratch );
+
+    //Cancels the render in flight and hands a new one to the workers, needs the mutex
+    void replaceCurrent( RenderJob* job );
+
+    //Claims an idle framebuffer and fills it with copies of the genomes, needs the mutex
+    RenderJob* prepare( const std::vector<Node*>& genomes, int columns, int gutter, int passes, int width, int height, View view );
+
+    //The render in flight if it is a single image, needs the mutex
+    RenderJob* getSingle();
+
+    //Worker threads and the state they wait on
+    std::vector<SDL_Thread*> mThreads;
+    SDL_mutex* mMutex;
+    SDL_cond* mWork;
+    SDL_cond* mIdle;
+    bool mQuit;
+
+    //Framebuffers, the one being rendered and the one the texture shows
+    RenderJob mJobs[ RENDER_BUFFERS ];
+    RenderJob* mCurrent;
+    RenderJob* mShown;
+    std::vector<Uint32> mBlank;
+    int mSerial;
+
+    //Bumped whenever the job in flight changes, so speculative workers step aside
+    SDL_atomic_t mForeground;
+};
+
+RenderPipeline::RenderPipeline()
+{
+    //Initialize
+    mMutex = SDL_CreateMutex();
+    mWork = SDL_CreateCond();
+    mIdle = SDL_CreateCond();
+    mQuit = false;
+    mCurrent = NULL;
+    mShown = NULL;
+    mSerial = 0;
+    SDL_AtomicSet( &mForeground, 0 );
+}
+
+RenderPipeline::~RenderPipeline()
+{
+    //Deallocate
+    free();
+    SDL_DestroyCond( mIdle );
+    SDL_DestroyCond( mWork );
+    SDL_DestroyMutex( mMutex );
+}
+
+bool RenderPipeline::init( int threads )
+{
+    //Always keep at least one worker
+    if( threads < 1 )
+    {
+        threads = 1;
+    }
+
+    mQuit = false;
+    for( int i = 0; i < threads; ++i )
+    {
+        SDL_Thread* thread = SDL_CreateThread( workerMain, "RenderWorker", this );
+        if( thread == NULL )
+        {
+            SDL_Log( "Unable to create render thread! SDL Error: %s\n", SDL_GetError() );
+            break;
+        }
+        mThreads.push_back( thread );
+    }
+
+    return !mThreads.empty();
+}
+
+void RenderPipeline::start( Node* genome, int width, int height, View view )
+{
+    SDL_LockMutex( mMutex );
+    replaceCurrent( prepare( std::vector<Node*>( 1, genome ), 1, 0, 1, width, height, view ) );
+    SDL_UnlockMutex( mMutex );
+}
+
+bool RenderPipeline::pan( int dx, int dy )
+{
+    SDL_LockMutex( mMutex );
+
+    RenderJob* old = getSingle();
+    if( old == NULL )
+    {
+        SDL_UnlockMutex( mMutex );
+        return false;
+    }
+
+    //Pixel (x,y) of the new render is pixel (x+dx,y+dy) of the old one
+    int w = old->width;
+    int h = old->height;
+    View view = old->view;
+    view.x += dx * view.scale / ( w * .5 );
+    view.y += dy * view.scale / ( h * .5 );
+    RenderJob* job = prepare( old->genomes, 1, 0, 1, w, h, view );
+
+    int keepBegin = std::max( 0, -dx );
+    int keepEnd = std::min( w, w - dx );
+    job->preview.assign( w * h, 0 );
+    job->todo.clear();
+    for( int y = 0; y < h; ++y )
+    {
+        int oy = y + dy;
+        Uint32* shown = NULL;
+        Uint32* final = NULL;
+        if( oy >= 0 && oy < h )
+        {
+            shown = old->getReadyRow( oy );
+            final = old->getFinalRow( oy );
+        }
+
+        //Whatever the old render shows is the preview
+        if( shown != NULL && keepBegin < keepEnd )
+        {
+            memcpy( &job->preview[ y * w + keepBegin ], &shown[ keepBegin + dx ], ( keepEnd - keepBegin ) * sizeof( Uint32 ) );
+        }
+
+        //Finished rows are reused and only their exposed strip is evaluated
+        if( final != NULL && keepBegin < keepEnd )
+        {
+            memcpy( &job->pixels[ y * w + keepBegin ], &final[ keepBegin + dx ], ( keepEnd - keepBegin ) * sizeof( Uint32 ) );
+            job->spanBegin[ y ] = dx > 0 ? keepEnd : 0;
+            job->spanEnd[ y ] = dx < 0 ? keepBegin : dx > 0 ? w : 0;
+        }
+
+        if( job->spanBegin[ y ] < job->spanEnd[ y ] )
+        {
+            job->todo.push_back( y );
+        }
+        else
+        {
+            SDL_AtomicSet( &job->unitReady[ y ], 1 );
+        }
+    }
+
+    if( job->todo.empty() )
+    {
+        SDL_AtomicSet( &job->finishTicks, (int)job->startTicks );
+    }
+
+    replaceCurrent( job );
+    SDL_UnlockMutex( mMutex );
+    return true;
+}
+
+bool RenderPipeline::zoom( double factor, int focusX, int focusY )
+{
+    SDL_LockMutex( mMutex );
+
+    RenderJob* old = getSingle();
+    if( old == NULL )
+    {
+        SDL_UnlockMutex( mMutex );
+        return false;
+    }
+
+    //Keep the point under the focus pixel where it is
+    int w = old->width;
+    int h = old->height;
+    View view = old->view;
+    view.scale = std::max( view.scale * factor, 1e-12 );
+    view.x = old->view.x + ( focusX - w * .5 ) / ( w * .5 ) * ( old->view.scale - view.scale );
+    view.y = old->view.y + ( focusY - h * .5 ) / ( h * .5 ) * ( old->view.scale - view.scale );
+    RenderJob* job = prepare( old->genomes, 1, 0, ZOOM_PASSES, w, h, view );
+
+    //Stretch the old pixels into the preview, nearest neighbour
+    double ratio = view.scale / old->view.scale;
+    std::vector<int> columns( w );
+    for( int x = 0; x < w; ++x )
+    {
+        double ox = ( view.x - old->view.x ) / old->view.scale * ( w * .5 ) + ( x - w * .5 ) * ratio + w * .5;
+        columns[ x ] = ox >= 0 && ox < w ? (int)ox : -1;
+    }
+    job->preview.assign( w * h, 0 );
+    for( int y = 0; y < h; ++y )
+    {
+        double oy = ( view.y - old->view.y ) / old->view.scale * ( h * .5 ) + ( y - h * .5 ) * ratio + h * .5;
+        Uint32* shown = oy >= 0 && oy < h ? old->getReadyRow( (int)oy ) : NULL;
+        if( shown == NULL )
+        {
+            continue;
+        }
+        for( int x = 0; x < w; ++x )
+        {
+            if( columns[ x ] >= 0 )
+            {
+                job->preview[ y * w + x ] = shown[ columns[ x ] ];
+            }
+        }
+    }
+
+    replaceCurrent( job );
+    SDL_UnlockMutex( mMutex );
+    return true;
+}
+
+View RenderPipeline::getView()
+{
+    if( mCurrent == NULL )
+    {
+        return DEFAULT_VIEW;
+    }
+    return mCurrent->view;
+}
+
+RenderJob* RenderPipeline::getSingle()
+{
+    if( mCurrent == NULL || mCurrent->genomes.size() != 1 || mCurrent->gutter != 0 )
+    {
+        return NULL;
+    }
+    return mCurrent;
+}
+
+void RenderPipeline::startGallery( const std::vector<Node*>& genomes, int columns, int width, int height )
+{
+    SDL_LockMutex( mMutex );
+    replaceCurrent( prepare( genomes, columns, GALLERY_GUTTER, GALLERY_PASSES, width, height, DEFAULT_VIEW ) );
+    SDL_UnlockMutex( mMutex );
+}
+
+int RenderPipeline::speculate( Node* genome, int width, int height, View view )
+{
+    SDL_LockMutex( mMutex );
+
+    //Speculation never waits for a framebuffer, it only uses spare ones
+    int serial = -1;
+    for( int i = 0; i < RENDER_BUFFERS; ++i )
+    {
+        RenderJob* job = &mJobs[ i ];
+        if( job != mCurrent && job->users == 0 && !( job->speculative && SDL_AtomicGet( &job->cancelled ) == 0 ) )
+        {
+            job = prepare( std::vector<Node*>( 1, genome ), 1, 0, 1, width, height, view );
+            job->speculative = true;
+            serial = job->serial;
+            SDL_CondBroadcast( mWork );
+            break;
+        }
+    }
+
+    SDL_UnlockMutex( mMutex );
+    return serial;
+}
+
+bool RenderPipeline::promote( int serial )
+{
+    SDL_LockMutex( mMutex );
+
+    //Find the speculative render, it may have been cancelled or recycled since
+    RenderJob* job = NULL;
+    for( int i = 0; i < RENDER_BUFFERS; ++i )
+    {
+        if( mJobs[ i ].serial == serial && mJobs[ i ].speculative && SDL_AtomicGet( &mJobs[ i ].cancelled ) == 0 )
+        {
+            job = &mJobs[ i ];
+        }
+    }
+
+    if( job != NULL )
+    {
+        job->speculative = false;
+        replaceCurrent( job );
+    }
+
+    SDL_UnlockMutex( mMutex );
+    return job != NULL;
+}
+
+void RenderPipeline::cancelSpeculative()
+{
+    SDL_LockMutex( mMutex );
+    for( int i = 0; i < RENDER_BUFFERS; ++i )
+    {
+        if( mJobs[ i ].speculative )
+        {
+            SDL_AtomicSet( &mJobs[ i ].cancelled, 1 );
+        }
+    }
+    SDL_UnlockMutex( mMutex );
+}
+
+void RenderPipeline::replaceCurrent( RenderJob* job )
+{
+    //Cancel the render in flight, its workers drop out after their current row
+    if( mCurrent != NULL && mCurrent != job )
+    {
+        SDL_AtomicSet( &mCurrent->cancelled, 1 );
+    }
+
+    mCurrent = job;
+    SDL_AtomicAdd( &mForeground, 1 );
+    SDL_CondBroadcast( mWork );
+}
+
+RenderJob* RenderPipeline::prepare( const std::vector<Node*>& genomes, int columns, int gutter, int passes, int width, int height, View view )
+{
+    //Take a framebuffer that is not live and no worker is still writing to
+    RenderJob* job = NULL;
+    while( job == NULL )
+    {
+        for( int i = 0; i < RENDER_BUFFERS; ++i )
+        {
+            RenderJob* slot = &mJobs[ i ];
+            bool live = slot == mCurrent || ( slot->speculative && SDL_AtomicGet( &slot->cancelled ) == 0 );
+            if( slot->users == 0 && !live )
+            {
+                job = slot;
+                break;
+            }
+        }
+        if( job == NULL )
+        {
+            SDL_CondWait( mIdle, mMutex );
+        }
+    }
+
+    //The job renders its own copies so the caller is free to mutate the genomes
+    for( size_t i = 0; i < job->genomes.size(); ++i )
+    {
+        deleteTree( job->genomes[ i ] );
+    }
+    job->genomes.clear();
+    for( size_t i = 0; i < genomes.size(); ++i )
+    {
+        job->genomes.push_back( copyTree( genomes[ i ] ) );
+    }
+
+    //Lay out the cells, sized to a multiple of the coarsest step
+    int rows = ( genomes.size() + columns - 1 ) / columns;
+    int coarsest = 1 << ( passes - 1 );
+    job->columns = columns;
+    job->gutter = gutter;
+    job->passes = passes;
+    job->width = width;
+    job->height = height;
+    job->cellWidth = width / columns / coarsest * coarsest;
+    job->cellHeight = height / rows / coarsest * coarsest;
+    job->serial = ++mSerial;
+    job->speculative = false;
+    job->startTicks = SDL_GetTicks();
+    job->view = view;
+
+    job->firstUnit.assign( passes + 1, 0 );
+    for( int pass = 0; pass < passes; ++pass )
+    {
+        int step = job->getStep( pass );
+        job->firstUnit[ pass + 1 ] = job->firstUnit[ pass ] + ( height + step - 1 ) / step;
+    }
+
+    SDL_atomic_t notReady = { 0 };
+    job->pixels.assign( passes * width * height, 0 );
+    job->unitReady.assign( job->getUnits(), notReady );
+    job->rowShown.assign( height, -1 );
+    job->spanBegin.assign( height, 0 );
+    job->spanEnd.assign( height, job->cellWidth - gutter );
+    job->preview.clear();
+    job->todo.resize( job->getUnits() );
+    for( int unit = 0; unit < job->getUnits(); ++unit )
+    {
+        job->todo[ unit ] = unit;
+    }
+    SDL_AtomicSet( &job->nextUnit, 0 );
+    SDL_AtomicSet( &job->unitsDone, 0 );
+    SDL_AtomicSet( &job->cancelled, 0 );
+    SDL_AtomicSet( &job->finishTicks, 0 );
+
+    return job;
+}
+
+int RenderPipeline::upload( LTexture& texture )
+{
+    //Only the UI thread changes the current job, so it can be read without locking
+    RenderJob* job = mCurrent;
+    if( job == NULL )
+    {
+        return 0;
+    }
+
+    //Show the preview when a new render starts, or blank the texture so the background shows through
+    if( job != mShown )
+    {
+        SDL_Rect all = { 0, 0, job->width, job->height };
+        if( !job->preview.empty() )
+        {
+            texture.updatePixels( &all, &job->preview[ 0 ], job->width * 4 );
+        }
+        else
+        {
+            mBlank.assign( job->width * job->height, 0 );
+            texture.updatePixels( &all, &mBlank[ 0 ], job->width * 4 );
+        }
+        mShown = job;
+    }
+
+    //Upload each run of consecutive rows that have a finer pass ready than the one shown
+    int uploaded = 0;
+    int y = 0;
+    while( y < job->height )
+    {
+        int best = -1;
+        for( int pass = job->passes - 1; pass > job->rowShown[ y ]; --pass )
+        {
+            if( SDL_AtomicGet( &job->unitReady[ job->firstUnit[ pass ] + y / job->getStep( pass ) ] ) != 0 )
+            {
+                best = pass;
+                break;
+            }
+        }
+        if( best < 0 )
+        {
+            ++y;
+            continue;
+        }
+
+        int first = y;
+        while( y < job->height && job->rowShown[ y ] < best &&
+               SDL_AtomicGet( &job->unitReady[ job->firstUnit[ best ] + y / job->getStep( best ) ] ) != 0 )
+        {
+            job->rowShown[ y ] = best;
+            ++y;
+        }
+
+        SDL_Rect rows = { 0, first, job->width, y - first };
+        Uint32* buffer = &job->pixels[ best * job->width * job->height ];
+        texture.updatePixels( &rows, &buffer[ first * job->width ], job->width * 4 );
+        uploaded += y - first;
+    }
+
+    return uploaded;
+}
+
+int RenderPipeline::getCellAt( int x, int y )
+{
+    RenderJob* job = mCurrent;
+    if( job == NULL || x < 0 || y < 0 )
+    {
+        return -1;
+    }
+
+    int column = x / job->cellWidth;
+    int index = ( y / job->cellHeight ) * job->columns + column;
+    if( column >= job->columns || index >= job->genomes.size() )
+    {
+        return -1;
+    }
+    return index;
+}
+
+bool RenderPipeline::isComplete()
+{
+    return mCurrent != NULL && SDL_AtomicGet( &mCurrent->unitsDone ) >= mCurrent->todo.size();
+}
+
+Uint32 RenderPipeline::getRenderTime()
+{
+    if( mCurrent == NULL )
+    {
+        return 0;
+    }
+    if( isComplete() )
+    {
+        return (Uint32)SDL_AtomicGet( &mCurrent->finishTicks ) - mCurrent->startTicks;
+    }
+    return SDL_GetTicks() - mCurrent->startTicks;
+}
+
+void RenderPipeline::free()
+{
+    //Wake every worker and wait for it to leave
+    SDL_LockMutex( mMutex );
+    mQuit = true;
+    for( int i = 0; i < RENDER_BUFFERS; ++i )
+    {
+        SDL_AtomicSet( &mJobs[ i ].cancelled, 1 );
+    }
+    SDL_CondBroadcast( mWork );
+    SDL_UnlockMutex( mMutex );
+
+    for( size_t i = 0; i < mThreads.size(); ++i )
+    {
+        SDL_WaitThread( mThreads[ i ], NULL );
+    }
+    mThreads.clear();
+
+    //Free the genome copies
+    for( int i = 0; i < RENDER_BUFFERS; ++i )
+    {
+        for( size_t n = 0; n < mJobs[ i ].genomes.size(); ++n )
+        {
+            deleteTree( mJobs[ i ].genomes[ n ] );
+        }
+        mJobs[ i ].genomes.clear();
+    }
+    mCurrent = NULL;
+    mShown = NULL;
+}
+
+int RenderPipeline::workerMain( void* data )
+{
+    flushSubnormals();
+    ( (RenderPipeline*)data )->workerLoop();
+    return 0;
+}
+
+void RenderPipeline::workerLoop()
+{
+    bool lowPriority = false;
+    SpanScratch scratch;
+
+    SDL_LockMutex( mMutex );
+    while( !mQuit )
+    {
+        //The render in flight comes first, speculative renders only get idle workers
+        RenderJob* job = NULL;
+        if( mCurrent != NULL && mCurrent->hasRowsLeft() )
+        {
+            job = mCurrent;
+        }
+        else
+        {
+            for( int i = 0; i < RENDER_BUFFERS; ++i )
+            {
+                if( mJobs[ i ].speculative && mJobs[ i ].hasRowsLeft() )
+                {
+                    job = &mJobs[ i ];
+                    break;
+                }
+            }
+        }
+
+        //Sleep until there are rows left to claim
+        if( job == NULL )
+        {
+            SDL_CondWait( mWork, mMutex );
+            continue;
+        }
+
+        bool speculative = job->speculative;
+        int foreground = SDL_AtomicGet( &mForeground );
+        job->users++;
+        SDL_UnlockMutex( mMutex );
+
+        //Speculative rows run at reduced priority so they never slow the UI
+        if( speculative != lowPriority )
+        {
+            SDL_SetThreadPriority( speculative ? SDL_THREAD_PRIORITY_LOW : SDL_THREAD_PRIORITY_NORMAL );
+            lowPriority = speculative;
+        }
+        renderRows( job, speculative ? foreground : -1, scratch );
+
+        SDL_LockMutex( mMutex );
+        job->users--;
+        SDL_CondBroadcast( mIdle );
+    }
+    SDL_UnlockMutex( mMutex );
+}
+
+void RenderPipeline::renderRows( RenderJob* job, int foreground, SpanScratch& scratch )
+{
+    //Claim units until the job runs out or is cancelled, or a new foreground render needs the worker
+    int units = job->todo.size();
+    while( SDL_AtomicGet( &job->cancelled ) == 0 )
+    {
+        if( foreground >= 0 && SDL_AtomicGet( &mForeground ) != foreground )
+        {
+            break;
+        }
+
+        int next = SDL_AtomicAdd( &job->nextUnit, 1 );
+        if( next >= units )
+        {
+            break;
+        }
+        int unit = job->todo[ next ];
+
+        renderUnit( job, unit, scratch );
+        flushProfile( scratch );
+
+        //Publish the unit only after its pixels are written
+        SDL_AtomicSet( &job->unitReady[ unit ], 1 );
+        if( SDL_AtomicAdd( &job->unitsDone, 1 ) + 1 == units )
+        {
+            SDL_AtomicSet( &job->finishTicks, (int)SDL_GetTicks() );
+        }
+    }
+}
+
+//Renders the art in the background
+RenderPipeline gPipeline;
+
+//Debug text lines currently shown, so textures are only rebuilt when text changes
+std::string gTextShown[4];
+
+/*
+ * Draw one line of debug text, rebuilding its texture only when it changed
+ */
+void renderTextLine(LTexture& texture, std::string& shown, std::string text, int y){
+    if (text != shown){
+        SDL_Color textColor = { 255,255,255 };
+        texture.loadFromRenderedText(text, textColor);
+        shown = text;
+    }
+    texture.render(0, y);
+}
+
+/*
+ * Spread the toolbar buttons evenly across a band of the screen
+ */
+void layoutButtons(int top, int bottom){
+    int w = gScreenRect.w / BUTTONS;
+    for (int n = 0; n < BUTTONS; n++){
+        SDL_Rect rect = { n * w, top, w, bottom - top };
+        gButtonRects[n] = rect;
+    }
+}
+
+/*
+ * Toolbar button under a point, or -1
+ */
+int buttonAt(SDL_Point point){
+    for (int n = 0; n < BUTTONS; n++){
+        SDL_Rect r = gButtonRects[n];
+        if (point.x >= r.x && point.x < r.x + r.w && point.y >= r.y && point.y < r.y + r.h){
+            return n;
+        }
+    }
+    return -1;
+}
+
+void renderButtons(){
+    SDL_SetRenderDrawColor(gRenderer, 255,255,255, 255);
+    for (int n = 0; n < BUTTONS; n++){
+        SDL_Rect r = gButtonRects[n];
+        SDL_Rect outline = { r.x + 8, r.y + 8, r.w - 16, r.h - 16 };
+        SDL_RenderDrawRect(gRenderer, &outline);
+        gButtonText[n].render(r.x + (r.w - gButtonText[n].getWidth()) / 2, r.y + (r.h - gButtonText[n].getHeight()) / 2);
+    }
+}
+
+/*
+ * Count the color channels whose corners all match, 3 strikes is boring 1-color art
+ */
+int countStrikes(Node* genome){
+    int strikes = 0;
+    for (int n = 0; n < 3; n++) {
+        Uint32 compare1 = packChannel(evalNode(genome, 0, 0, n) * 255);
+        Uint32 compare2 = packChannel(evalNode(genome, 1, 0, n) * 255);
+        Uint32 compare3 = packChannel(evalNode(genome, 0, 1, n) * 255);
+        Uint32 compare4 = packChannel(evalNode(genome, 1, 1, n) * 255);
+        if (compare1 == compare2 && compare2 == compare3 && compare3 == compare4) {
+            strikes += 1;
+        }
+    }
+    return strikes;
+}
+
+//A child of root and its render in the background
+struct Candidate{
+    Node* genome;
+    Uint64 hash;
+    int job;
+};
+
+//Fingerprints of the art shown so far, so children that look like it are skipped
+HashIndex gSeen;
+SpanScratch gHashScratch;
+
+//Give up looking for a child that looks new after this many near-duplicates
+const int DUPLICATE_TRIES = 16;
+
+//Give up looking for a child worth rendering after this many batches scored nothing
+const int SCREEN_TRIES = 8;
+
+/*
+ * Whether a fingerprint looks like art already shown or like one of its siblings
+ */
+bool looksSeen(Uint64 hash, const std::vector<Uint64>& siblings){
+    if (gSeen.contains(hash, DUPLICATE_DISTANCE)){
+        return true;
+    }
+    for (int n = 0; n < siblings.size(); n++){
+        if (hashDistance(hash, siblings[n]) <= DUPLICATE_DISTANCE){
+            return true;
+        }
+    }
+    return false;
+}
+
+//Children of root waiting for the next tap, drawn from their own random stream
+std::vector<Candidate> gCandidates;
+RandomStream gCandidateRng(time(0) * 2654435761ULL);
+
+/*
+ * Mutate a batch of children of a genome and screen them together, the ones worth rendering come back best first.
+ * With fallback, a batch where none is worth rendering still gives back its best child
+ */
+void screenChildren(Node* parent, View view, RandomStream* rng, std::vector<Node*>& children, bool fallback){
+    std::vector<Node*> batch;
+    for (int n = 0; n < SCREEN_BATCH; n++){
+        batch.push_back(mutateExpression(parent, 0, rng));
+    }
+    std::vector<ScreenStats> stats;
+    screenCandidates(batch, view, stats, gHashScratch);
+
+    int best = 0;
+    for (int n = 1; n < batch.size(); n++){
+        if (stats[n].score > stats[best].score){
+            best = n;
+        }
+    }
+    std::vector< std::pair<double, int> > order;
+    for (int n = 0; n < batch.size(); n++){
+        if (stats[n].score > 0 || (fallback && !(stats[best].score > 0) && n == best)){
+            order.push_back(std::make_pair(-stats[n].score, n));
+        }else {
+            deleteTree(batch[n]);
+        }
+    }
+    std::sort(order.begin(), order.end());
+    children.clear();
+    for (int n = 0; n < order.size(); n++){
+        children.push_back(batch[order[n].second]);
+    }
+}
+
+/*
+ * Mutate the next children of a genome and render the best of them while the user looks at it
+ */
+void speculate(Node* parent, int width, int height, View view){
+    std::vector<Node*> children;
+    screenChildren(parent, view, &gCandidateRng, children, false);
+    int next = 0;
+    while (next < children.size() && gCandidates.size() < SPECULATIVE_CANDIDATES){
+        Node* genome = children[next++];
+        std::vector<Uint64> siblings;
+        for (int n = 0; n < gCandidates.size(); n++){
+            siblings.push_back(gCandidates[n].hash);
+        }
+        Uint64 hash = fingerprint(genome, view, gHashScratch);
+        if (looksSeen(hash, siblings)){
+            deleteTree(genome);
+            continue;
+        }
+
+        Candidate candidate;
+        candidate.genome = genome;
+        candidate.hash = hash;
+        candidate.job = gPipeline.speculate(genome, width, height, view);
+        if (candidate.job < 0){
+            deleteTree(genome);
+            break;
+        }
+        gCandidates.push_back(candidate);
+    }
+    for (; next < children.size(); next++){
+        deleteTree(children[next]);
+    }
+}
+
+/*
+ * Throw away the children rendered ahead
+ */
+void dropCandidates(){
+    gPipeline.cancelSpeculative();
+    for (int n = 0; n < gCandidates.size(); n++){
+        deleteTree(gCandidates[n].genome);
+    }
+    gCandidates.clear();
+}
+
+//Gallery columns, 0 while showing the single image
+int gGalleryColumns = 0;
+
+//While exploring, drags pan and pinches zoom the single image instead of mutating it
+bool gExploring = false;
+View gView = DEFAULT_VIEW;
+
+//Children shown as gallery thumbnails
+std::vector<Node*> gGallery;
+
+void clearGallery(){
+    for (int n = 0; n < gGallery.size(); n++){
+        deleteTree(gGallery[n]);
+    }
+    gGallery.clear();
+}
+
+/*
+ * Fill the gallery with children of a genome and render them side by side as thumbnails
+ */
+void startGallery(Node* parent, int columns, int width, int height){
+    clearGallery();
+    std::vector<Uint64> hashes;
+    int duplicates = 0;
+    int empty = 0;
+    while (gGallery.size() < columns * columns){
+        std::vector<Node*> children;
+        screenChildren(parent, DEFAULT_VIEW, NULL, children, empty >= SCREEN_TRIES);
+        empty += children.empty() ? 1 : 0;
+        for (int n = 0; n < children.size(); n++){
+            Node* child = children[n];
+            if (gGallery.size() == columns * columns){
+                deleteTree(child);
+                continue;
+            }
+            Uint64 hash = fingerprint(child, DEFAULT_VIEW, gHashScratch);
+            if (duplicates < DUPLICATE_TRIES * columns && looksSeen(hash, hashes)){
+                duplicates++;
+                deleteTree(child);
+                continue;
+            }
+            gGallery.push_back(child);
+            hashes.push_back(hash);
+        }
+    }
+    for (int n = 0; n < hashes.size(); n++){
+        gSeen.insert(hashes[n]);
+    }
+    gPipeline.startGallery(gGallery, columns, width, height);
+}
+
+
+//Runs numbered tasks on worker threads, the calling thread helps while it waits
+typedef void (*TaskFunction)( void* data, int task, SpanScratch& scratch );
+
+class TaskPool
+{
+public:
+
+    TaskPool();
+    ~TaskPool();
+
+    //Starts the worker threads
+    bool init( int threads );
+
+    //Starts running tasks 0 to count-1 in the background
+    void begin( TaskFunction function, void* data, int count );
+
+    //Helps with the remaining tasks and waits until all of them are done
+    void finish();
+
+    //Runs tasks 0 to count-1 and waits for them
+    void run( TaskFunction function, void* data, int count );
+
+    //Number of threads running tasks, counting the caller
+    int getThreads();
+
+    //Stops the worker threads
+    void free();
+
+private:
+    static int workerMain( void* data );
+    void workerLoop();
+    void runTasks( TaskFunction function, void* data, int count, SpanScratch& scratch );
+
+    std::vector<SDL_Thread*> mThreads;
+    SDL_mutex* mMutex;
+    SDL_cond* mWork;
+    SDL_cond* mDone;
+    bool mQuit;
+
+    //The batch being run, guarded by the mutex apart from the counters
+    TaskFunction mFunction;
+    void* mData;
+    int mCount;
+    int mActive;
+    SDL_atomic_t mNext;
+    SDL_atomic_t mFinished;
+
+    //Scratch for the calling thread
+    SpanScratch mScratch;
+};
+
+TaskPool::TaskPool()
+{
+    //Initialize
+    mMutex = SDL_CreateMutex();
+    mWork = SDL_CreateCond();
+    mDone = SDL_CreateCond();
+    mQuit = false;
+    mFunction = NULL;
+    mData = NULL;
+    mCount = 0;
+    mActive = 0;
+    SDL_AtomicSet( &mNext, 0 );
+    SDL_AtomicSet( &mFinished, 0 );
+}
+
+TaskPool::~TaskPool()
+{
+    //Deallocate
+    free();
+    SDL_DestroyCond( mDone );
+    SDL_DestroyCond( mWork );
+    SDL_DestroyMutex( mMutex );
+}
+
+bool TaskPool::init( int threads )
+{
+    mQuit = false;
+    for( int i = 0; i < threads; ++i )
+    {
+        SDL_Thread* thread = SDL_CreateThread( workerMain, "TaskWorker", this );
+        if( thread == NULL )
+        {
+            SDL_Log( "Unable to create task thread! SDL Error: %s\n", SDL_GetError() );
+            break;
+        }
+        mThreads.push_back( thread );
+    }
+
+    return (int)mThreads.size() == threads;
+}
+
+void TaskPool::begin( TaskFunction function, void* data, int count )
+{
+    SDL_LockMutex( mMutex );
+    mFunction = function;
+    mData = data;
+    mCount = count;
+    SDL_AtomicSet( &mNext, 0 );
+    SDL_AtomicSet( &mFinished, 0 );
+    SDL_CondBroadcast( mWork );
+    SDL_UnlockMutex( mMutex );
+}
+
+void TaskPool::finish()
+{
+    SDL_LockMutex( mMutex );
+    TaskFunction function = mFunction;
+    void* data = mData;
+    int count = mCount;
+    SDL_UnlockMutex( mMutex );
+
+    if( function == NULL )
+    {
+        return;
+    }
+    runTasks( function, data, count, mScratch );
+
+    //Wait for the stragglers, and for every worker to leave the batch before it can be replaced
+    SDL_LockMutex( mMutex );
+    while( SDL_AtomicGet( &mFinished ) < mCount || mActive > 0 )
+    {
+        SDL_CondWait( mDone, mMutex );
+    }
+    mFunction = NULL;
+    SDL_UnlockMutex( mMutex );
+}
+
+void TaskPool::run( TaskFunction function, void* data, int count )
+{
+    begin( function, data, count );
+    finish();
+}
+
+int TaskPool::getThreads()
+{
+    return mThreads.size() + 1;
+}
+
+void TaskPool::free()
+{
+    SDL_LockMutex( mMutex );
+    mQuit = true;
+    SDL_CondBroadcast( mWork );
+    SDL_UnlockMutex( mMutex );
+
+    for( size_t i = 0; i < mThreads.size(); ++i )
+    {
+        SDL_WaitThread( mThreads[ i ], NULL );
+    }
+    mThreads.clear();
+}
+
+int TaskPool::workerMain( void* data )
+{
+    flushSubnormals();
+    ( (TaskPool*)data )->workerLoop();
+    return 0;
+}
+
+void TaskPool::workerLoop()
+{
+    SpanScratch scratch;
+
+    SDL_LockMutex( mMutex );
+    while( !mQuit )
+    {
+        //Sleep until a batch has tasks left to claim
+        if( mFunction == NULL || SDL_AtomicGet( &mNext ) >= mCount )
+        {
+            SDL_CondWait( mWork, mMutex );
+            continue;
+        }
+
+        TaskFunction function = mFunction;
+        void* data = mData;
+        int count = mCount;
+        mActive++;
+        SDL_UnlockMutex( mMutex );
+
+        runTasks( function, data, count, scratch );
+
+        SDL_LockMutex( mMutex );
+        mActive--;
+        SDL_CondBroadcast( mDone );
+    }
+    SDL_UnlockMutex( mMutex );
+}
+
+void TaskPool::runTasks( TaskFunction function, void* data, int count, SpanScratch& scratch )
+{
+    while( true )
+    {
+        int task = SDL_AtomicAdd( &mNext, 1 );
+        if( task >= count )
+        {
+            break;
+        }
+        function( data, task, scratch );
+        flushProfile( scratch );
+        if( SDL_AtomicAdd( &mFinished, 1 ) + 1 == count )
+        {
+            SDL_LockMutex( mMutex );
+            SDL_CondBroadcast( mDone );
+            SDL_UnlockMutex( mMutex );
+        }
+    }
+}
+
+
+//Writes an image a row at a time, top to bottom
+class ImageWriter
+{
+public:
+
+    virtual ~ImageWriter() {}
+
+    //Creates the file
+    virtual bool open( std::string path, int width, int height ) = 0;
+
+    //Appends the next row of RGBA8888 pixels
+    virtual bool writeRow( const Uint32* pixels ) = 0;
+
+    //Finishes the file
+    virtual bool close() = 0;
+
+    //Bytes written so far
+    virtual Uint64 getBytes() = 0;
+};
+
+//Streams a PNG, compressing each row as it arrives so no more than one row is held
+class PngWriter : public ImageWriter
+{
+public:
+
+    PngWriter();
+    ~PngWriter();
+
+    bool open( std::string path, int width, int height );
+    bool writeRow( const Uint32* pixels );
+    bool close();
+    Uint64 getBytes();
+
+    //Encodes into memory instead of a file
+    bool open( std::vector<unsigned char>* buffer, int width, int height );
+
+private:
+    //Writes the signature and header and starts compressing
+    bool start( int width, int height );
+
+    //Appends bytes to the file or buffer
+    void put( const void* data, size_t length );
+
+    //Writes a chunk with its length and CRC
+    bool writeChunk( const char* type, const unsigned char* data, Uint32 length );
+
+    //Compresses into IDAT chunks, flushing the stream when finishing
+    bool deflateInto( int flush );
+
+    FILE* mFile;
+    std::vector<unsigned char>* mBuffer;
+    z_stream mStream;
+    bool mStreaming;
+    int mWidth;
+    Uint64 mBytes;
+    std::vector<unsigned char> mRow;
+    std::vector<unsigned char> mOut;
+};
+
+PngWriter::PngWriter()
+{
+    //Initialize
+    mFile = NULL;
+    mBuffer = NULL;
+    mStreaming = false;
+    mWidth = 0;
+    mBytes = 0;
+}
+
+PngWriter::~PngWriter()
+{
+    //Deallocate
+    close();
+}
+
+bool PngWriter::open( std::string path, int width, int height )
+{
+    mFile = fopen( path.c_str(), "wb" );
+    if( mFile == NULL )
+    {
+        SDL_Log( "Unable to create %s!\n", path.c_str() );
+        return false;
+    }
+
+    return start( width, height );
+}
+
+bool PngWriter::open( std::vector<unsigned char>* buffer, int width, int height )
+{
+    mBuffer = buffer;
+    mBuffer->clear();
+
+    return start( width, height );
+}
+
+bool PngWriter::start( int width, int height )
+{
+    //Signature and header, 8-bit RGB
+    static const unsigned char signature[ 8 ] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    unsigned char header[ 13 ] = {
+        (unsigned char)( width >> 24 ), (unsigned char)( width >> 16 ), (unsigned char)( width >> 8 ), (unsigned char)width,
+        (unsigned char)( height >> 24 ), (unsigned char)( height >> 16 ), (unsigned char)( height >> 8 ), (unsigned char)height,
+        8, 2, 0, 0, 0 };
+    mBytes = 0;
+    put( signature, sizeof( signature ) );
+    writeChunk( "IHDR", header, sizeof( header ) );
+
+    memset( &mStream, 0, sizeof( mStream ) );
+    if( deflateInit( &mStream, 6 ) != Z_OK )
+    {
+        SDL_Log( "Unable to start PNG compression!\n" );
+        return false;
+    }
+    mStreaming = true;
+    mWidth = width;
+    mRow.resize( 1 + width * 3 );
+    mOut.resize( 1 << 16 );
+
+    return true;
+}
+
+bool PngWriter::writeRow( const Uint32* pixels )
+{
+    //Sub filter: each byte minus the same channel of the pixel to its left
+    mRow[ 0 ] = 1;
+    unsigned char left[ 3 ] = { 0, 0, 0 };
+    for( int x = 0; x < mWidth; ++x )
+    {
+        unsigned char rgb[ 3 ] = { (unsigned char)( pixels[ x ] >> 24 ), (unsigned char)( pixels[ x ] >> 16 ), (unsigned char)( pixels[ x ] >> 8 ) };
+        for( int c = 0; c < 3; ++c )
+        {
+            mRow[ 1 + x * 3 + c ] = rgb[ c ] - left[ c ];
+            left[ c ] = rgb[ c ];
+        }
+    }
+
+    mStream.next_in = &mRow[ 0 ];
+    mStream.avail_in = mRow.size();
+    return deflateInto( Z_NO_FLUSH );
+}
+
+bool PngWriter::close()
+{
+    bool success = true;
+
+    if( mStreaming )
+    {
+        success = deflateInto( Z_FINISH );
+        deflateEnd( &mStream );
+        mStreaming = false;
+        success = writeChunk( "IEND", NULL, 0 ) && success;
+    }
+    if( mFile != NULL )
+    {
+        success = fclose( mFile ) == 0 && success;
+        mFile = NULL;
+    }
+    mBuffer = NULL;
+
+    return success;
+}
+
+Uint64 PngWriter::getBytes()
+{
+    return mBytes;
+}
+
+bool PngWriter::writeChunk( const char* type, const unsigned char* data, Uint32 length )
+{
+    unsigned char size[ 4 ] = { (unsigned char)( length >> 24 ), (unsigned char)( length >> 16 ), (unsigned char)( length >> 8 ), (unsigned char)length };
+    uLong crc = crc32( 0, (const Bytef*)type, 4 );
+    if( length > 0 )
+    {
+        crc = crc32( crc, data, length );
+    }
+    unsigned char check[ 4 ] = { (unsigned char)( crc >> 24 ), (unsigned char)( crc >> 16 ), (unsigned char)( crc >> 8 ), (unsigned char)crc };
+
+    put( size, 4 );
+    put( type, 4 );
+    put( data, length );
+    put( check, 4 );
+
+    return mFile == NULL || ferror( mFile ) == 0;
+}
+
+void PngWriter::put( const void* data, size_t length )
+{
+    if( length == 0 )
+    {
+        return;
+    }
+    if( mFile != NULL )
+    {
+        fwrite( data, 1, length, mFile );
+    }
+    else if( mBuffer != NULL )
+    {
+        mBuffer->insert( mBuffer->end(), (const unsigned char*)data, (const unsigned char*)data + length );
+    }
+    mBytes += length;
+}
+
+bool PngWriter::deflateInto( int flush )
+{
+    //Emit an IDAT chunk whenever the output buffer fills up
+    while( true )
+    {
+        mStream.next_out = &mOut[ 0 ];
+        mStream.avail_out = mOut.size();
+        int status = deflate( &mStream, flush );
+        Uint32 produced = mOut.size() - mStream.avail_out;
+        if( produced > 0 && !writeChunk( "IDAT", &mOut[ 0 ], produced ) )
+        {
+            return false;
+        }
+        if( status == Z_STREAM_END || ( flush == Z_NO_FLUSH && mStream.avail_in == 0 && mStream.avail_out > 0 ) )
+        {
+            return true;
+        }
+        if( status != Z_OK && status != Z_BUF_ERROR )
+        {
+            SDL_Log( "PNG compression failed!\n" );
+            return false;
+        }
+    }
+}
+
+//Writes a binary PPM through a memory map that slides down the file, so only a window is mapped
+class MappedPpmWriter : public ImageWriter
+{
+public:
+
+    MappedPpmWriter();
+    ~MappedPpmWriter();
+
+    bool open( std::string path, int width, int height );
+    bool writeRow( const Uint32* pixels );
+    bool close();
+    Uint64 getBytes();
+
+private:
+    //Maps the window starting at a row
+    bool mapWindow( int row );
+    void unmapWindow();
+
+    int mFile;
+    int mWidth;
+    int mHeight;
+    int mRow;
+    Uint64 mHeader;
+
+    //The mapped window, its first row and how many rows it holds
+    unsigned char* mMap;
+    size_t mMapLength;
+    unsigned char* mWindow;
+    int mWindowRow;
+    int mWindowRows;
+};
+
+//Bytes of the file mapped at once
+const size_t PPM_WINDOW = 32 << 20;
+
+MappedPpmWriter::MappedPpmWriter()
+{
+    //Initialize
+    mFile = -1;
+    mWidth = 0;
+    mHeight = 0;
+    mRow = 0;
+    mHeader = 0;
+    mMap = NULL;
+    mMapLength = 0;
+    mWindow = NULL;
+    mWindowRow = 0;
+    mWindowRows = 0;
+}
+
+MappedPpmWriter::~MappedPpmWriter()
+{
+    //Deallocate
+    close();
+}
+
+bool MappedPpmWriter::open( std::string path, int width, int height )
+{
+    mFile = ::open( path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( mFile < 0 )
+    {
+        SDL_Log( "Unable to create %s!\n", path.c_str() );
+        return false;
+    }
+
+    //Header, then reserve the whole file so a full disk fails here rather than in a mapped store
+    char header[ 64 ];
+    int length = snprintf( header, sizeof( header ), "P6\n%d %d\n255\n", width, height );
+    mHeader = length;
+    mWidth = width;
+    mHeight = height;
+    mRow = 0;
+    if( write( mFile, header, length ) != length || posix_fallocate( mFile, 0, mHeader + (Uint64)width * height * 3 ) != 0 )
+    {
+        SDL_Log( "Unable to size %s!\n", path.c_str() );
+        return false;
+    }
+
+    return true;
+}
+
+bool MappedPpmWriter::writeRow( const Uint32* pixels )
+{
+    if( mMap == NULL || mRow >= mWindowRow + mWindowRows )
+    {
+        if( !mapWindow( mRow ) )
+        {
+            return false;
+        }
+    }
+
+    unsigned char* out = mWindow + (size_t)( mRow - mWindowRow ) * mWidth * 3;
+    for( int x = 0; x < mWidth; ++x )
+    {
+        out[ x * 3 ] = pixels[ x ] >> 24;
+        out[ x * 3 + 1 ] = pixels[ x ] >> 16;
+        out[ x * 3 + 2 ] = pixels[ x ] >> 8;
+    }
+    mRow++;
+
+    return true;
+}
+
+bool MappedPpmWriter::close()
+{
+    unmapWindow();
+    if( mFile >= 0 )
+    {
+        ::close( mFile );
+        mFile = -1;
+    }
+    return true;
+}
+
+Uint64 MappedPpmWriter::getBytes()
+{
+    return mHeader + (Uint64)mRow * mWidth * 3;
+}
+
+bool MappedPpmWriter::mapWindow( int row )
+{
+    unmapWindow();
+
+    //Maps start on a page boundary, so the window may begin a little before the row
+    Uint64 rowBytes = (Uint64)mWidth * 3;
+    Uint64 start = mHeader + row * rowBytes;
+    Uint64 page = sysconf( _SC_PAGESIZE );
+    Uint64 aligned = start / page * page;
+    mWindowRows = std::max( (Uint64)1, PPM_WINDOW / rowBytes );
+    mWindowRows = std::min( mWindowRows, mHeight - row );
+    mMapLength = start - aligned + mWindowRows * rowBytes;
+
+    void* map = mmap( NULL, mMapLength, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, aligned );
+    if( map == MAP_FAILED )
+    {
+        SDL_Log( "Unable to map output rows!\n" );
+        mMap = NULL;
+        return false;
+    }
+    mMap = (unsigned char*)map;
+    mWindow = mMap + ( start - aligned );
+    mWindowRow = row;
+
+    return true;
+}
+
+void MappedPpmWriter::unmapWindow()
+{
+    if( mMap != NULL )
+    {
+        munmap( mMap, mMapLength );
+        mMap = NULL;
+    }
+}
+
+
+//Exports render a band of tiles while the band before it is written out
+const int EXPORT_TILE = 256;
+
+//One band of an export, a row of tiles across the whole image
+struct ExportBand{
+    Node* genome;
+    int width;
+    int height;
+    View view;
+    AntiAlias aa;
+    int y;
+    int rows;
+    std::vector<Uint32> pixels;
+    SDL_atomic_t refined;
+};
+
+void renderExportTile(void* data, int task, SpanScratch& scratch){
+    ExportBand* band = (ExportBand*)data;
+    int x = task * EXPORT_TILE;
+    SDL_Rect tile = { x, band->y, std::min(EXPORT_TILE, band->width - x), band->rows };
+    int refined = renderRegionAA(band->genome, band->width, band->height, band->view, tile, &band->pixels[x], band->width, band->aa, scratch);
+    SDL_AtomicAdd(&band->refined, refined);
+}
+
+/*
+ * Load a genome written by writeGenome from a file, - for standard input
+ */
+Node* loadGenome(std::string path){
+    if (path == "-"){
+        return readGenome(std::cin);
+    }
+    std::ifstream in(path.c_str());
+    if (!in){
+        SDL_Log("Unable to open %s!\n", path.c_str());
+        return NULL;
+    }
+    return readGenome(in);
+}
+
+/*
+ * Render a genome written out by --compile through its compiled span from now on, canonical when
+ * it was compiled with --canonical, library is the shared library it was loaded from, NULL when it is built in
+ */
+bool bakeGenome(const char* text, BakedSpan span, bool canonical, void* library){
+    Node* genome = genomeFromString(text);
+    if (genome == NULL){
+        SDL_Log("The compiled genome is malformed!\n");
+        return false;
+    }
+    gBaked.genome = genome;
+    gBaked.span = span;
+    gBaked.canonical = canonical;
+    gBaked.library = library;
+    return true;
+}
+
+/*
+ * Load a genome compiled by --compile and built as a shared library
+ */
+bool loadKernel(std::string path){
+    void* library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL){
+        SDL_Log("Unable to load %s: %s\n", path.c_str(), dlerror());
+        return false;
+    }
+    typedef const char* (*GenomeText)();
+    GenomeText text = (GenomeText)dlsym(library, "eruptionGenome");
+    BakedSpan span = (BakedSpan)dlsym(library, "eruptionSpan");
+    if (text == NULL || span == NULL){
+        SDL_Log("%s is not a compiled genome!\n", path.c_str());
+        dlclose(library);
+        return false;
+    }
+
+    //Kernels from before the mode was switchable always canonicalized
+    typedef int (*CanonicalMode)();
+    CanonicalMode canonical = (CanonicalMode)dlsym(library, "eruptionCanonical");
+    if (!bakeGenome(text(), span, canonical == NULL || canonical() != 0, library)){
+        dlclose(library);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * The compiled tree in place of a genome that is the same, so renders of it run native code
+ */
+Node* preferBaked(Node* genome){
+    if (genome == NULL || gBaked.genome == NULL || gBaked.canonical != gCanonical || genome == gBaked.genome || !sameTree(genome, gBaked.genome)){
+        return genome;
+    }
+    deleteTree(genome);
+    return copyTree(gBaked.genome);
+}
+
+/*
+ * Whether a tree holds a color vector, so its value depends on the channel
+ */
+bool readsChannel(Node* node, std::map<Node*, bool>& memo){
+    if (node == NULL){
+        return false;
+    }
+    std::map<Node*, bool>::iterator found = memo.find(node);
+    if (found != memo.end()){
+        return found->second;
+    }
+    bool reads = node->kind == VECTOR || readsChannel(node->left, memo) || readsChannel(node->right, memo);
+    memo[node] = reads;
+    return reads;
+}
+
+//Functions a genome is compiled into, one per node, or per node and channel where it holds a color vector
+struct CompiledGenome{
+    std::map<Node*, bool> colored;
+    std::map< std::pair<Node*, int>, std::string > names;
+    std::ostringstream code;
+};
+
+/*
+ * Write a node out as a C++ function of the point and time, after the functions it calls, and return
+ * its name. It does exactly what evalNode does, through the same kernels, without looking anything up
+ */
+std::string compileNode(Node* node, int channel, CompiledGenome& compiled){
+    if (node->kind == VECTOR){
+        return compileNode(channel == 0 ? node->r : channel == 1 ? node->g : node->b, channel, compiled);
+    }
+    std::pair<Node*, int> key(node, readsChannel(node, compiled.colored) ? channel : -1);
+    std::map< std::pair<Node*, int>, std::string >::iterator found = compiled.names.find(key);
+    if (found != compiled.names.end()){
+        return found->second;
+    }
+
+    std::ostringstream body;
+    body.precision(17);
+    const char* handOnCall = gCanonical ? "canonical" : "";
+    if (node->kind == NUMBER){
+        body << "    return " << handOn(node->number) << ";\n";
+    }else if (node->kind == VARIABLE && node->code >= 0 && node->code < VARIABLE_COUNT){
+        body << "    return " << (node->code == 0 ? "x" : node->code == 1 ? "y" : "t") << ";\n";
+    }else if (node->kind != OPERATOR || node->code < 0){
+        body << "    return 0.0;\n";
+    }else{
+        const Operator& op = OPERATORS[node->code];
+        std::string left = "0.0";
+        if (node->left != NULL && op.arity == 2){
+            left = compileNode(node->left, channel, compiled) + "(x, y, t)";
+        }
+        std::string right = node->right != NULL ? compileNode(node->right, channel, compiled) : "";
+        if (op.taps != NULL){
+            body << "    double radius = spatialRadius(" << left << ");\n";
+            body << "    double a = 0, b = 0, sample;\n";
+            for (int k = 0; k < op.tapCount; k++){
+                const Tap& tap = op.taps[k];
+                if (right.empty()){
+                    body << "    sample = 0.0;\n";
+                }else {
+                    body << "    sample = " << right << "(x + " << tap.dx << " * radius, y + " << tap.dy << " * radius, t);\n";
+                }
+                body << "    a += " << tap.a << " * sample;\n";
+                body << "    b += " << tap.b << " * sample;\n";
+            }
+            body << "    return " << handOnCall << "(" << op.kernel << "(a, b));\n";
+        }else{
+            body << "    return " << handOnCall << "(" << op.kernel << "(" << left << ", " << (right.empty() ? "0.0" : right + "(x, y, t)") << "));\n";
+        }
+    }
+
+    std::ostringstream name;
+    name << "baked" << compiled.names.size();
+    compiled.names[key] = name.str();
+    compiled.code << "static inline double " << name.str() << "(double x, double y, double t){\n" << body.str() << "}\n\n";
+    return name.str();
+}
+
+/*
+ * Compile a genome into a C++ file that evaluates it with every operator inlined, to build as a
+ * shared library for --kernel or into a viewer built around it with BAKED_GENOME
+ */
+int compileGenome(Node* genome, std::string path){
+    std::ofstream out(path.c_str());
+    if (!out){
+        SDL_Log("Unable to open %s!\n", path.c_str());
+        return 1;
+    }
+
+    CompiledGenome compiled;
+    std::string channels[3];
+    for (int channel = 0; channel < 3; channel++){
+        channels[channel] = compileNode(genome, channel, compiled);
+    }
+
+    std::string text = genomeToString(genome);
+    std::string quoted;
+    for (size_t n = 0; n < text.size(); n++){
+        if (text[n] == '"' || text[n] == '\\') quoted += '\\';
+        quoted += text[n];
+    }
+
+    out << "//Compiled by eruption --compile from\n";
+    out << "//    " << text << "\n";
+    out << "//Evaluates just like the interpreter, through the same kernels. Build it with the app's floating\n";
+    out << "//point flags, as a shared library for --kernel:\n";
+    out << "//    c++ -O3 -shared -fPIC -I<folder with eruption.cpp> " << path << " -o genome.so\n";
+    out << "//or into a viewer that opens on it by building eruption.cpp with -DBAKED_GENOME='\"" << path << "\"'\n";
+    out << "#ifndef ERUPTION_BAKING\n";
+    out << "#define ERUPTION_KERNELS_ONLY\n";
+    out << "#include \"eruption.cpp\"\n";
+    out << "#endif\n\n";
+    out << compiled.code.str();
+    out << "extern \"C\" const char* eruptionGenome(){\n";
+    out << "    return \"" << quoted << "\";\n";
+    out << "}\n\n";
+    out << "extern \"C\" int eruptionCanonical(){\n";
+    out << "    return " << (gCanonical ? 1 : 0) << ";\n";
+    out << "}\n\n";
+    out << "extern \"C\" void eruptionSpan(const double* x, const double* y, int count, int channel, double t, double* out){\n";
+    for (int channel = 0; channel < 3; channel++){
+        out << "    " << (channel == 0 ? "if (channel == 0)" : channel == 1 ? "}else if (channel == 1)" : "}else") << "{\n";
+        out << "        for (int i = 0; i < count; i++) out[i] = " << channels[channel] << "(x[i], y[i], t);\n";
+    }
+    out << "    }\n";
+    out << "}\n";
+
+    out.close();
+    if (!out){
+        SDL_Log("Unable to write %s!\n", path.c_str());
+        return 1;
+    }
+    printf("compile: %d functions written to %s\n", (int)compiled.names.size(), path.c_str());
+    return 0;
+}
+
+/*
+ * Whether a path ends in an extension, in any case
+ */
+bool hasExtension(std::string path, std::string extension){
+    if (path.size() <= extension.size()){
+        return false;
+    }
+    for (size_t n = 0; n < extension.size(); n++){
+        if (tolower((unsigned char)path[path.size() - extension.size() + n]) != tolower((unsigned char)extension[n])){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The writer an image path asks for by its extension, NULL when it isn't .png or .ppm
+ */
+ImageWriter* chooseWriter(std::string path, PngWriter& png, MappedPpmWriter& ppm){
+    if (hasExtension(path, ".png")){
+        return &png;
+    }
+    if (hasExtension(path, ".ppm")){
+        return &ppm;
+    }
+    SDL_Log("Unable to write %s, images must end in .png or .ppm!\n", path.c_str());
+    return NULL;
+}
+
+/*
+ * Render a genome at any size straight to disk, holding two bands of tiles at a time
+ */
+int exportImage(Node* genome, std::string path, int width, int height, View view, AntiAlias aa){
+    PngWriter png;
+    MappedPpmWriter ppm;
+    ImageWriter* writer = chooseWriter(path, png, ppm);
+    if (writer == NULL || !writer->open(path, width, height)){
+        return 1;
+    }
+
+    TaskPool pool;
+    pool.init(SDL_GetCPUCount() - 1);
+
+    ExportBand bands[2];
+    for (int n = 0; n < 2; n++){
+        bands[n].genome = genome;
+        bands[n].width = width;
+        bands[n].height = height;
+        bands[n].view = view;
+        bands[n].aa = aa;
+        bands[n].pixels.resize((size_t)width * EXPORT_TILE);
+    }
+    Uint64 refined = 0;
+    int tiles = (width + EXPORT_TILE - 1) / EXPORT_TILE;
+
+    //Render band n+1 in the background while band n is encoded
+    Uint64 start = SDL_GetPerformanceCounter();
+    int count = (height + EXPORT_TILE - 1) / EXPORT_TILE;
+    bool success = true;
+    for (int n = 0; n <= count && success; n++){
+        if (n < count){
+            ExportBand& next = bands[n % 2];
+            next.y = n * EXPORT_TILE;
+            next.rows = std::min(EXPORT_TILE, height - next.y);
+            SDL_AtomicSet(&next.refined, 0);
+            pool.begin(renderExportTile, &next, tiles);
+        }
+        if (n > 0){
+            ExportBand& done = bands[(n - 1) % 2];
+            for (int y = 0; y < done.rows && success; y++){
+                success = writer->writeRow(&done.pixels[(size_t)y * width]);
+            }
+
+            double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+            int rows = done.y + done.rows;
+            printf("\rexport: %d/%d rows, %.2f Mpixel/s, %.1f MB written", rows, height,
+                   (double)rows * width / seconds / 1e6, writer->getBytes() / 1e6);
+            if (aa.samples > 0){
+                refined += SDL_AtomicGet(&done.refined);
+                printf(", %.1f%% anti-aliased", 100.0 * refined / ((double)rows * width));
+            }
+            fflush(stdout);
+        }
+        pool.finish();
+    }
+    printf("\n");
+
+    pool.free();
+    if (gProfiling){
+        printf("evaluation profile:\n");
+        printProfile(gProfile);
+    }
+    success = writer->close() && success;
+    return success ? 0 : 1;
+}
+
+//Animations render this many frames per batch, while the batch before is written out
+const int ANIMATION_BATCH = 4;
+
+//Frame rate written into Y4M headers unless --fps says otherwise
+const int ANIMATION_FPS = 30;
+
+int countNodes(Node* prev){
+    if (prev == NULL){
+        return 0;
+    }
+    if (prev->kind == VECTOR){
+        return 1 + countNodes(prev->r) + countNodes(prev->g) + countNodes(prev->b);
+    }
+    if (prev->kind == OPERATOR){
+        return 1 + countNodes(prev->left) + countNodes(prev->right);
+    }
+    return 1;
+}
+
+/*
+ * Whether a tree reads T, collecting the largest subtrees that don't into stills. Single
+ * leaves are left out, and so is anything a spatial operator samples away from the pixel
+ */
+bool findStills(Node* prev, bool shifted, std::vector<Node*>& stills){
+    if (prev == NULL || prev->kind == NUMBER){
+        return false;
+    }
+    if (prev->kind == VARIABLE){
+        return prev->code == 2;
+    }
+
+    Node* children[3] = { NULL, NULL, NULL };
+    bool moved[3] = { shifted, shifted, shifted };
+    if (prev->kind == VECTOR){
+        children[0] = prev->r;
+        children[1] = prev->g;
+        children[2] = prev->b;
+    }else{
+        const Operator* op = prev->code >= 0 ? &OPERATORS[prev->code] : NULL;
+        if (op == NULL || op->arity == 2) children[0] = prev->left;
+        children[1] = prev->right;
+        if (op != NULL && op->taps != NULL) moved[1] = true;
+    }
+
+    bool reads[3];
+    bool any = false;
+    for (int n = 0; n < 3; n++){
+        reads[n] = findStills(children[n], moved[n], stills);
+        any = any || reads[n];
+    }
+    for (int n = 0; n < 3 && any; n++){
+        Node* child = children[n];
+        if (child != NULL && !reads[n] && !moved[n] && child->kind != NUMBER && child->kind != VARIABLE){
+            stills.push_back(child);
+        }
+    }
+    return any;
+}
+
+bool largerTree(Node* a, Node* b){
+    return countNodes(a) > countNodes(b);
+}
+
+//Still subtrees of an animation rendered over the whole frame, three channel planes each
+struct StillPlanes{
+    std::vector<Node*> stills;
+    int width;
+    int height;
+    View view;
+    std::vector< std::vector<double> > planes;
+};
+
+void renderStillRow(void* data, int task, SpanScratch& scratch){
+    StillPlanes* job = (StillPlanes*)data;
+    int width = job->width;
+    double half_w = width * .5;
+    double half_h = job->height * .5;
+    double left = job->view.x - job->view.scale;
+    double dx = job->view.scale / half_w;
+    scratch.xs.resize(width);
+    scratch.ys.resize(width);
+    for (int i = 0; i < width; i++){
+        scratch.xs[i] = left + i * dx;
+        scratch.ys[i] = job->view.y + (task - half_h) / half_h * job->view.scale;
+    }
+    for (size_t n = 0; n < job->planes.size(); n++){
+        evalSpan(job->stills[n / 3], &scratch.xs[0], &scratch.ys[0], width, n % 3, &job->planes[n][task * width], scratch);
+    }
+}
+
+//A batch of animation frames, rendered a row per task
+struct AnimationBatch{
+    Node* genome;
+    const StillPlanes* stills;
+    int first;
+    int frames;
+    int total;
+    std::vector<Uint32> pixels;
+};
+
+void renderAnimationRow(void* data, int task, SpanScratch& scratch){
+    AnimationBatch* batch = (AnimationBatch*)data;
+    const StillPlanes* stills = batch->stills;
+    int width = stills->width;
+    int height = stills->height;
+    int frame = task / height;
+    int y = task % height;
+
+    scratch.time = (double)(batch->first + frame) / batch->total;
+    scratch.stills.resize(stills->planes.size());
+    for (size_t n = 0; n < stills->planes.size(); n++){
+        scratch.stills[n] = &stills->planes[n][y * width];
+    }
+    double half_h = height * .5;
+    double fy = stills->view.y + (y - half_h) / half_h * stills->view.scale;
+    renderSpan(batch->genome, stills->view.x - stills->view.scale, stills->view.scale / (width * .5), 0, 1, fy, width,
+               &batch->pixels[((Uint64)frame * height + y) * width], scratch);
+    scratch.stills.clear();
+    scratch.time = 0;
+}
+
+/*
+ * Write one frame of RGBA8888 pixels as Y4M, full resolution BT.601 YCbCr, or as raw RGB
+ */
+bool writeFrame(FILE* out, const Uint32* pixels, int count, bool raw, std::vector<unsigned char>& buffer){
+    buffer.resize(count * 3);
+    for (int i = 0; i < count; i++){
+        int r = pixels[i] >> 24;
+        int g = (pixels[i] >> 16) & 0xFF;
+        int b = (pixels[i] >> 8) & 0xFF;
+        if (raw){
+            buffer[i * 3] = r;
+            buffer[i * 3 + 1] = g;
+            buffer[i * 3 + 2] = b;
+        }else{
+            buffer[i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            buffer[count + i] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            buffer[count * 2 + i] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+    if (!raw && fputs("FRAME\n", out) == EOF){
+        return false;
+    }
+    return fwrite(&buffer[0], 1, buffer.size(), out) == buffer.size();
+}
+
+/*
+ * Render frames of a genome with T going from 0 towards 1 and stream them to a file, or - for
+ * standard output, as Y4M video or raw RGB. Subtrees that don't read T are rendered only once.
+ */
+int exportAnimation(Node* genome, std::string path, int width, int height, int frames, View view, int fps, bool raw, size_t stillBytes){
+    if (width <= 0 || height <= 0 || frames <= 0){
+        SDL_Log("Nothing to animate!\n");
+        return 1;
+    }
+    FILE* out = path == "-" ? stdout : fopen(path.c_str(), "wb");
+    if (out == NULL){
+        SDL_Log("Unable to open %s!\n", path.c_str());
+        return 1;
+    }
+    FILE* log = out == stdout ? stderr : stdout;
+
+    //Swap the largest still subtrees that fit in memory for planes rendered up front, a compiled genome runs whole
+    bool baked = genome == gBaked.genome;
+    Node* animated = baked ? copyTree(genome) : cloneTree(genome);
+    StillPlanes stills;
+    stills.width = width;
+    stills.height = height;
+    stills.view = view;
+    std::vector<Node*> found;
+    if (!baked && !findStills(animated, false, found) && animated->kind != NUMBER && animated->kind != VARIABLE){
+        found.push_back(animated);
+    }
+    std::stable_sort(found.begin(), found.end(), largerTree);
+    size_t planeBytes = (size_t)width * height * 3 * sizeof(double);
+    for (size_t n = 0; n < found.size() && (stills.stills.size() + 1) * planeBytes <= stillBytes; n++){
+        Node* node = found[n];
+        stills.stills.push_back(new Node(*node));
+        node->kind = VARIABLE;
+        node->op = "still";
+        node->code = VARIABLE_COUNT + (int)stills.stills.size() - 1;
+        node->left = NULL;
+        node->right = NULL;
+    }
+
+    TaskPool pool;
+    pool.init(SDL_GetCPUCount() - 1);
+    Uint64 start = SDL_GetPerformanceCounter();
+    stills.planes.resize(stills.stills.size() * 3, std::vector<double>((size_t)width * height));
+    if (!stills.planes.empty()){
+        pool.run(renderStillRow, &stills, height);
+    }
+    fprintf(log, "animate: %d of %d nodes are still, rendered once in %.2f s\n", countNodes(genome) - countNodes(animated) + (int)stills.stills.size(),
+            countNodes(genome), (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency());
+
+    bool success = true;
+    if (!raw){
+        success = fprintf(out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, fps) > 0;
+    }
+
+    //Render batch n+1 in the background while batch n is written
+    AnimationBatch batches[2];
+    for (int n = 0; n < 2; n++){
+        batches[n].genome = animated;
+        batches[n].stills = &stills;
+        batches[n].total = frames;
+        batches[n].pixels.resize((size_t)ANIMATION_BATCH * width * height);
+    }
+    std::vector<unsigned char> buffer;
+    int count = (frames + ANIMATION_BATCH - 1) / ANIMATION_BATCH;
+    for (int n = 0; n <= count && success; n++){
+        if (n < count){
+            AnimationBatch& next = batches[n % 2];
+            next.first = n * ANIMATION_BATCH;
+            next.frames = std::min(ANIMATION_BATCH, frames - next.first);
+            pool.begin(renderAnimationRow, &next, next.frames * height);
+        }
+        if (n > 0){
+            AnimationBatch& done = batches[(n - 1) % 2];
+            for (int frame = 0; frame < done.frames && success; frame++){
+                success = writeFrame(out, &done.pixels[(size_t)frame * width * height], width * height, raw, buffer);
+            }
+
+            double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+            int written = done.first + done.frames;
+            fprintf(log, "\ranimate: %d/%d frames, %.1f frames/s", written, frames, written / seconds);
+            fflush(log);
+        }
+        pool.finish();
+    }
+    fprintf(log, "\n");
+
+    pool.free();
+    if (gProfiling){
+        fprintf(log, "evaluation profile:\n");
+        printProfile(gProfile, log);
+    }
+    if (out == stdout){
+        success = fflush(out) == 0 && success;
+    }else{
+        success = fclose(out) == 0 && success;
+    }
+    if (!success){
+        SDL_Log("Unable to write %s!\n", path.c_str());
+    }
+
+    deleteTree(animated);
+    for (size_t n = 0; n < stills.stills.size(); n++){
+        deleteTree(stills.stills[n]);
+    }
+    return success ? 0 : 1;
+}
+
+//Renders for other processes are drawn in small tiles so even thumbnails use every core
+const int SERVICE_TILE = 64;
+
+//Largest region the render service draws for one request
+const int SERVICE_MAX_PIXELS = 4096 * 4096;
+
+//Default memory for encoded renders kept by the render service
+const size_t SERVICE_CACHE_BYTES = 256 << 20;
+
+//A render asked of the service, the genome by its structural hash
+struct RenderKey{
+    Uint64 hash;
+    int width;
+    int height;
+    View view;
+    SDL_Rect region;
+
+    bool operator<(const RenderKey& other) const {
+        if (hash != other.hash) return hash < other.hash;
+        if (width != other.width) return width < other.width;
+        if (height != other.height) return height < other.height;
+        if (view.x != other.view.x) return view.x < other.view.x;
+        if (view.y != other.view.y) return view.y < other.view.y;
+        if (view.scale != other.view.scale) return view.scale < other.view.scale;
+        if (region.x != other.region.x) return region.x < other.region.x;
+        if (region.y != other.region.y) return region.y < other.region.y;
+        if (region.w != other.region.w) return region.w < other.region.w;
+        return region.h < other.region.h;
+    }
+};
+
+//A region of an image rendered as tiles on a task pool
+struct RegionJob{
+    Node* genome;
+    RenderKey key;
+    AntiAlias aa;
+    int tile;       //side of the squares the region is split into, one task each
+    int across;
+    std::vector<Uint32> pixels;
+};
+
+void renderRegionTile(void* data, int task, SpanScratch& scratch){
+    RegionJob* job = (RegionJob*)data;
+    SDL_Rect region = job->key.region;
+    int x = task % job->across * job->tile;
+    int y = task / job->across * job->tile;
+    SDL_Rect tile = { region.x + x, region.y + y, std::min(job->tile, region.w - x), std::min(job->tile, region.h - y) };
+    renderRegionAA(job->genome, job->key.width, job->key.height, job->key.view, tile, &job->pixels[y * region.w + x], region.w, job->aa, scratch);
+}
+
+//Where a render served by the service came from
+const int SERVED_RENDERED = 0,
+          SERVED_CACHED = 1,
+          SERVED_SHARED = 2;
+
+//Renders genomes to PNG for other processes, keeping recent results in an LRU cache
+class RenderService
+{
+public:
+
+    RenderService();
+    ~RenderService();
+
+    //Starts the render threads
+    bool init( int threads, AntiAlias aa, size_t cacheBytes );
+
+    //Encodes a render of a genome, from the cache, or shared with an identical request in flight
+    //Returns how it was served, or -1 if it failed
+    int render( Node* genome, RenderKey key, std::vector<unsigned char>& png );
+
+    //Counts of renders served each way, cached renders and their bytes
+    std::string getStats();
+
+    //Stops the render threads and empties the cache
+    void free();
+
+private:
+    //An encoded render in the cache
+    struct CacheEntry{
+        RenderKey key;
+        std::vector<unsigned char> png;
+    };
+
+    //A render in flight that identical requests wait for
+    struct PendingRender{
+        bool done;
+        bool failed;
+        int users;
+        std::vector<unsigned char> png;
+    };
+
+    //Renders and encodes on the task pool, one request at a time
+    bool draw( Node* genome, RenderKey key, std::vector<unsigned char>& png );
+
+    //Adds a render to the front of the cache, dropping the least recently used past the budget
+    void store( RenderKey key, const std::vector<unsigned char>& png );
+
+    SDL_mutex* mMutex;
+    SDL_cond* mFinished;
+    SDL_mutex* mDrawing;
+    TaskPool mPool;
+    AntiAlias mAA;
+
+    //Most recently used first, guarded by the mutex
+    std::list<CacheEntry> mCache;
+    std::map<RenderKey, std::list<CacheEntry>::iterator> mIndex;
+    std::map<RenderKey, PendingRender*> mPending;
+    size_t mBytes;
+    size_t mBudget;
+    Uint64 mServed[ 3 ];
+};
+
+RenderService::RenderService()
+{
+    //Initialize
+    mMutex = SDL_CreateMutex();
+    mFinished = SDL_CreateCond();
+    mDrawing = SDL_CreateMutex();
+    mAA = NO_ANTI_ALIAS;
+    mBytes = 0;
+    mBudget = SERVICE_CACHE_BYTES;
+    mServed[ 0 ] = mServed[ 1 ] = mServed[ 2 ] = 0;
+}
+
+RenderService::~RenderService()
+{
+    //Deallocate
+    free();
+    SDL_DestroyMutex( mDrawing );
+    SDL_DestroyCond( mFinished );
+    SDL_DestroyMutex( mMutex );
+}
+
+bool RenderService::init( int threads, AntiAlias aa, size_t cacheBytes )
+{
+    mAA = aa;
+    mBudget = cacheBytes;
+    return mPool.init( threads );
+}
+
+int RenderService::render( Node* genome, RenderKey key, std::vector<unsigned char>& png )
+{
+    SDL_LockMutex( mMutex );
+
+    //Served from memory, the entry moves to the front
+    std::map<RenderKey, std::list<CacheEntry>::iterator>::iterator cached = mIndex.find( key );
+    if( cached != mIndex.end() )
+    {
+        mCache.splice( mCache.begin(), mCache, cached->second );
+        png = cached->second->png;
+        mServed[ SERVED_CACHED ]++;
+        SDL_UnlockMutex( mMutex );
+        return SERVED_CACHED;
+    }
+
+    //An identical request is already rendering, wait for its result
+    std::map<RenderKey, PendingRender*>::iterator found = mPending.find( key );
+    if( found != mPending.end() )
+    {
+        PendingRender* pending = found->second;
+        pending->users++;
+        while( !pending->done )
+        {
+            SDL_CondWait( mFinished, mMutex );
+        }
+        bool failed = pending->failed;
+        png = pending->png;
+        if( --pending->users == 0 )
+        {
+            delete pending;
+        }
+        mServed[ SERVED_SHARED ]++;
+        SDL_UnlockMutex( mMutex );
+        return failed ? -1 : SERVED_SHARED;
+    }
+
+    PendingRender* pending = new PendingRender();
+    pending->done = false;
+    pending->failed = false;
+    pending->users = 1;
+    mPending[ key ] = pending;
+    SDL_UnlockMutex( mMutex );
+
+    bool success = draw( genome, key, png );
+
+    //Hand the result to everyone waiting and keep it for later
+    SDL_LockMutex( mMutex );
+    pending->done = true;
+    pending->failed = !success;
+    pending->png = png;
+    mPending.erase( key );
+    if( success )
+    {
+        store( key, png );
+    }
+    if( --pending->users == 0 )
+    {
+        delete pending;
+    }
+    mServed[ SERVED_RENDERED ]++;
+    SDL_CondBroadcast( mFinished );
+    SDL_UnlockMutex( mMutex );
+
+    return success ? SERVED_RENDERED : -1;
+}
+
+std::string RenderService::getStats()
+{
+    SDL_LockMutex( mMutex );
+    std::ostringstream out;
+    out << mServed[ SERVED_RENDERED ] << " " << mServed[ SERVED_CACHED ] << " " << mServed[ SERVED_SHARED ] << " "
+        << mCache.size() << " " << mBytes;
+    SDL_UnlockMutex( mMutex );
+    return out.str();
+}
+
+void RenderService::free()
+{
+    mPool.free();
+
+    SDL_LockMutex( mMutex );
+    mCache.clear();
+    mIndex.clear();
+    mBytes = 0;
+    SDL_UnlockMutex( mMutex );
+}
+
+bool RenderService::draw( Node* genome, RenderKey key, std::vector<unsigned char>& png )
+{
+    RegionJob job;
+    job.genome = genome;
+    job.key = key;
+    job.aa = mAA;
+    job.tile = SERVICE_TILE;
+    job.across = ( key.region.w + SERVICE_TILE - 1 ) / SERVICE_TILE;
+    job.pixels.resize( key.region.w * key.region.h );
+    int down = ( key.region.h + SERVICE_TILE - 1 ) / SERVICE_TILE;
+
+    //The pool runs one batch at a time, each render gets every core
+    SDL_LockMutex( mDrawing );
+    mPool.run( renderRegionTile, &job, job.across * down );
+    SDL_UnlockMutex( mDrawing );
+
+    PngWriter writer;
+    if( !writer.open( &png, key.region.w, key.region.h ) )
+    {
+        return false;
+    }
+    bool success = true;
+    for( int y = 0; y < key.region.h && success; ++y )
+    {
+        success = writer.writeRow( &job.pixels[ y * key.region.w ] );
+    }
+    return writer.close() && success;
+}
+
+void RenderService::store( RenderKey key, const std::vector<unsigned char>& png )
+{
+    if( mIndex.count( key ) > 0 )
+    {
+        return;
+    }
+
+    CacheEntry entry;
+    entry.key = key;
+    entry.png = png;
+    mCache.push_front( entry );
+    mIndex[ key ] = mCache.begin();
+    mBytes += png.size();
+
+    while( mBytes > mBudget && mCache.size() > 1 )
+    {
+        mBytes -= mCache.back().png.size();
+        mIndex.erase( mCache.back().key );
+        mCache.pop_back();
+    }
+}
+
+/*
+ * Next line from a socket without its newline, bytes read past it stay in the buffer
+ */
+bool readLine(int socket, std::string& buffer, std::string& line){
+    while (true){
+        size_t end = buffer.find('\n');
+        if (end != std::string::npos){
+            line = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            if (!line.empty() && line[line.size() - 1] == '\r'){
+                line.erase(line.size() - 1);
+            }
+            return true;
+        }
+
+        char chunk[4096];
+        ssize_t got = recv(socket, chunk, sizeof(chunk), 0);
+        if (got <= 0){
+            return false;
+        }
+        buffer.append(chunk, got);
+    }
+}
+
+bool sendAll(int socket, const void* data, size_t length){
+    const char* bytes = (const char*)data;
+    while (length > 0){
+        ssize_t sent = send(socket, bytes, length, MSG_NOSIGNAL);
+        if (sent <= 0){
+            return false;
+        }
+        bytes += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+bool sendLine(int socket, std::string line){
+    line += "\n";
+    return sendAll(socket, line.data(), line.size());
+}
+
+//A connection to the render service and the service it talks to
+struct ServiceClient{
+    RenderService* service;
+    int socket;
+};
+
+/*
+ * Answer a client's requests until it hangs up:
+ *   RENDER <width> <height> [x y scale [left top right bottom]]  then the genome on the next line
+ *     -> OK <bytes> <rendered|cached|shared> <microseconds>  then the PNG
+ *   STATS -> OK <rendered> <cached> <shared> <entries> <bytes>
+ * Anything else gets ERROR <reason>
+ */
+int serveClient(void* data){
+    flushSubnormals();
+    ServiceClient* client = (ServiceClient*)data;
+    static const char* served[3] = { "rendered", "cached", "shared" };
+    std::string buffer;
+    std::string line;
+    std::vector<unsigned char> png;
+    bool connected = true;
+
+    while (connected && readLine(client->socket, buffer, line)){
+        std::istringstream in(line);
+        std::string command;
+        in >> command;
+
+        if (command == "STATS"){
+            connected = sendLine(client->socket, "OK " + client->service->getStats());
+            continue;
+        }
+        if (command != "RENDER"){
+            connected = sendLine(client->socket, "ERROR unknown command");
+            continue;
+        }
+
+        RenderKey key;
+        key.view = DEFAULT_VIEW;
+        in >> key.width >> key.height;
+        bool sized = !in.fail() && key.width > 0 && key.height > 0;
+        if (in >> key.view.x){
+            in >> key.view.y >> key.view.scale;
+        }
+        int left = 0, top = 0, right = key.width, bottom = key.height;
+        if (in >> left){
+            in >> top >> right >> bottom;
+        }
+        key.region.x = std::max(0, left);
+        key.region.y = std::max(0, top);
+        key.region.w = std::min(right, key.width) - key.region.x;
+        key.region.h = std::min(bottom, key.height) - key.region.y;
+
+        std::string text;
+        if (!readLine(client->socket, buffer, text)){
+            break;
+        }
+        if (!sized || key.region.w <= 0 || key.region.h <= 0 || (Uint64)key.region.w * key.region.h > SERVICE_MAX_PIXELS){
+            connected = sendLine(client->socket, "ERROR bad size or region");
+            continue;
+        }
+        Node* genome = preferBaked(genomeFromString(text));
+        if (genome == NULL){
+            connected = sendLine(client->socket, "ERROR bad genome");
+            continue;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        key.hash = hashGenome(genome);
+        int how = client->service->render(genome, key, png);
+        deleteTree(genome);
+        Uint64 micros = (SDL_GetPerformanceCounter() - start) * 1000000 / SDL_GetPerformanceFrequency();
+        if (how < 0){
+            connected = sendLine(client->socket, "ERROR render failed");
+            continue;
+        }
+
+        std::ostringstream reply;
+        reply << "OK " << png.size() << " " << served[how] << " " << micros;
+        connected = sendLine(client->socket, reply.str()) && sendAll(client->socket, &png[0], png.size());
+    }
+
+    ::close(client->socket);
+    delete client;
+    return 0;
+}
+
+/*
+ * Serve renders on a Unix domain socket until killed, each client on its own thread
+ */
+int runService(std::string path, AntiAlias aa, size_t cacheBytes){
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)){
+        SDL_Log("Socket path %s is too long!\n", path.c_str());
+        return 1;
+    }
+    strcpy(address.sun_path, path.c_str());
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0){
+        SDL_Log("Unable to listen on %s!\n", path.c_str());
+        if (listener >= 0) ::close(listener);
+        return 1;
+    }
+
+    RenderService service;
+    service.init(SDL_GetCPUCount() - 1, aa, cacheBytes);
+    printf("serving renders on %s\n", path.c_str());
+    fflush(stdout);
+
+    while (true){
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0){
+            continue;
+        }
+        ServiceClient* client = new ServiceClient();
+        client->service = &service;
+        client->socket = connection;
+        SDL_Thread* thread = SDL_CreateThread(serveClient, "ServiceClient", client);
+        if (thread == NULL){
+            ::close(connection);
+            delete client;
+            continue;
+        }
+        SDL_DetachThread(thread);
+    }
+}
+
+//A candidate moving through the art farm
+struct FarmItem{
+    int index;
+    Node* genome;
+    std::vector<Uint32> pixels;
+};
+
+//Blocking queue between two farm stages, push waits while it is full so slow stages hold back fast ones
+class FarmQueue
+{
+public:
+
+    FarmQueue( int capacity );
+    ~FarmQueue();
+
+    //Waits for room, false if the queue was closed instead
+    bool push( FarmItem* item );
+
+    //Waits for an item, NULL once the queue is closed and empty
+    FarmItem* pop();
+
+    //No more items will be pushed
+    void close();
+
+    int getSize();
+
+private:
+    SDL_mutex* mMutex;
+    SDL_cond* mChanged;
+    std::list<FarmItem*> mItems;
+    int mCapacity;
+    bool mClosed;
+};
+
+FarmQueue::FarmQueue( int capacity )
+{
+    //Initialize
+    mMutex = SDL_CreateMutex();
+    mChanged = SDL_CreateCond();
+    mCapacity = capacity;
+    mClosed = false;
+}
+
+FarmQueue::~FarmQueue()
+{
+    //Deallocate
+    SDL_DestroyCond( mChanged );
+    SDL_DestroyMutex( mMutex );
+}
+
+bool FarmQueue::push( FarmItem* item )
+{
+    SDL_LockMutex( mMutex );
+    while( !mClosed && (int)mItems.size() >= mCapacity )
+    {
+        SDL_CondWait( mChanged, mMutex );
+    }
+    bool open = !mClosed;
+    if( open )
+    {
+        mItems.push_back( item );
+        SDL_CondBroadcast( mChanged );
+    }
+    SDL_UnlockMutex( mMutex );
+
+    return open;
+}
+
+FarmItem* FarmQueue::pop()
+{
+    SDL_LockMutex( mMutex );
+    while( !mClosed && mItems.empty() )
+    {
+        SDL_CondWait( mChanged, mMutex );
+    }
+    FarmItem* item = NULL;
+    if( !mItems.empty() )
+    {
+        item = mItems.front();
+        mItems.pop_front();
+        SDL_CondBroadcast( mChanged );
+    }
+    SDL_UnlockMutex( mMutex );
+
+    return item;
+}
+
+void FarmQueue::close()
+{
+    SDL_LockMutex( mMutex );
+    mClosed = true;
+    SDL_CondBroadcast( mChanged );
+    SDL_UnlockMutex( mMutex );
+}
+
+int FarmQueue::getSize()
+{
+    SDL_LockMutex( mMutex );
+    int size = mItems.size();
+    SDL_UnlockMutex( mMutex );
+    return size;
+}
+
+//Farm candidates descend from the previous one, going back to the seed this often
+const int FARM_LINEAGE = 16;
+
+//Farm stages in pipeline order
+const int FARM_GENERATE = 0,
+          FARM_FILTER = 1,
+          FARM_RENDER = 2,
+          FARM_WRITE = 3,
+          FARM_STAGES = 4;
+
+//Mass-produces art: generate, reject, render and encode run as separate stages on their own threads
+class ArtFarm
+{
+public:
+
+    ArtFarm();
+    ~ArtFarm();
+
+    //Writes count images of mutants of seed into dir, carrying on from dir's checkpoint if there is one
+    //Candidates whose fingerprint is within dedupe bits of an earlier one are rejected, -1 keeps them all
+    int run( Node* seed, std::string dir, int count, int width, int height, AntiAlias aa, int dedupe );
+
+private:
+    //Where the generator was before making a candidate, enough to pick up from there
+    struct Snapshot{
+        Uint64 rng;
+        std::string parent;
+    };
+
+    static int generateMain( void* data );
+    static int filterMain( void* data );
+    static int renderMain( void* data );
+    static int writeMain( void* data );
+    void generate();
+    void filter();
+    void render();
+    void write();
+
+    //Counts time a stage thread spent working
+    void addBusy( int stage, Uint64 ticks );
+
+    //Marks a candidate as written or rejected, and moves the checkpoint past everything finished
+    void finish( FarmItem* item, bool written );
+
+    //Drops a candidate the run stopped before finishing, a resumed run makes it again
+    void discard( FarmItem* item );
+
+    //Saves the checkpoint, or loads it back
+    void saveCheckpoint();
+    bool loadCheckpoint();
+
+    //Fingerprints the images written before the checkpoint, so a resumed run rejects what the first would have
+    void rebuildIndex();
+
+    std::string mDir;
+    int mCount;
+    int mWidth;
+    int mHeight;
+    AntiAlias mAA;
+    Node* mSeed;
+    std::string mSeedText;
+    Node* mParent;
+    RandomStream mRng;
+    int mNextIndex;
+    SDL_atomic_t mStop;
+
+    //Fingerprints of accepted candidates, only touched by the filter thread once running
+    HashIndex mIndex;
+    SpanScratch mIndexScratch;
+    int mDedupe;
+
+    FarmQueue mGenerated;
+    FarmQueue mAccepted;
+    FarmQueue mRendered;
+    int mThreads[ FARM_STAGES ];
+    int mRenderers;
+
+    //Progress, guarded by the mutex
+    SDL_mutex* mMutex;
+    Uint64 mBusy[ FARM_STAGES ];
+    int mWritten;
+    int mClaimed;
+    int mRejected;
+    int mDuplicates;
+
+    //Candidates before the checkpoint are all finished, those after it finished early wait in mFinished
+    int mCheckpoint;
+    int mCheckpointWritten;
+    std::map<int, bool> mFinished;
+    std::map<int, Snapshot> mSnapshots;
+};
+
+ArtFarm::ArtFarm() : mRng( time( 0 ) * 2654435761ULL ), mGenerated( 64 ), mAccepted( 8 ), mRendered( 8 )
+{
+    //Initialize
+    mCount = 0;
+    mWidth = 0;
+    mHeight = 0;
+    mAA = NO_ANTI_ALIAS;
+    mSeed = NULL;
+    mParent = NULL;
+    mNextIndex = 0;
+    SDL_AtomicSet( &mStop, 0 );
+    mMutex = SDL_CreateMutex();
+    for( int i = 0; i < FARM_STAGES; ++i )
+    {
+        mThreads[ i ] = 1;
+        mBusy[ i ] = 0;
+    }
+    mRenderers = 0;
+    mWritten = 0;
+    mClaimed = 0;
+    mRejected = 0;
+    mDuplicates = 0;
+    mDedupe = -1;
+    mCheckpoint = 0;
+    mCheckpointWritten = 0;
+}
+
+ArtFarm::~ArtFarm()
+{
+    //Deallocate
+    if( mSeed != NULL )
+    {
+        deleteTree( mSeed );
+    }
+    if( mParent != NULL )
+    {
+        deleteTree( mParent );
+    }
+    SDL_DestroyMutex( mMutex );
+}
+
+int ArtFarm::run( Node* seed, std::string dir, int count, int width, int height, AntiAlias aa, int dedupe )
+{
+    mDedupe = dedupe;
+    mDir = dir;
+    mCount = count;
+    mWidth = width;
+    mHeight = height;
+    mAA = aa;
+    mkdir( dir.c_str(), 0755 );
+
+    if( loadCheckpoint() )
+    {
+        printf( "farm: resuming at candidate %d with %d images written\n", mNextIndex, mWritten );
+        rebuildIndex();
+    }
+    else
+    {
+        mSeed = copyTree( seed );
+        mParent = copyTree( seed );
+    }
+    mSeedText = genomeToString( mSeed );
+    mClaimed = mWritten;
+    if( mWritten >= mCount )
+    {
+        return 0;
+    }
+
+    //Rendering gets every core, encoding a share of them, the cheap stages one thread each
+    int cores = SDL_GetCPUCount();
+    mThreads[ FARM_RENDER ] = std::max( 1, cores );
+    mThreads[ FARM_WRITE ] = std::max( 1, cores / 4 );
+    mRenderers = mThreads[ FARM_RENDER ];
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    int startWritten = mWritten;
+    static int (*const mains[ FARM_STAGES ])( void* ) = { generateMain, filterMain, renderMain, writeMain };
+    static const char* names[ FARM_STAGES ] = { "generate", "filter", "render", "write" };
+    std::vector<SDL_Thread*> threads[ FARM_STAGES ];
+    FarmQueue* outputs[ FARM_STAGES ] = { &mGenerated, &mAccepted, &mRendered, NULL };
+    for( int stage = 0; stage < FARM_STAGES; ++stage )
+    {
+        for( int i = 0; i < mThreads[ stage ]; ++i )
+        {
+            SDL_Thread* thread = SDL_CreateThread( mains[ stage ], "FarmStage", this );
+            if( thread != NULL )
+            {
+                threads[ stage ].push_back( thread );
+            }
+        }
+        if( stage == FARM_RENDER )
+        {
+            SDL_LockMutex( mMutex );
+            mRenderers -= mThreads[ stage ] - threads[ stage ].size();
+            SDL_UnlockMutex( mMutex );
+        }
+
+        //A stage with no threads stops the run, and its queue is closed for the stage after it
+        if( threads[ stage ].empty() )
+        {
+            SDL_Log( "Unable to create farm thread! SDL Error: %s\n", SDL_GetError() );
+            SDL_AtomicSet( &mStop, 1 );
+            if( outputs[ stage ] != NULL )
+            {
+                outputs[ stage ]->close();
+            }
+        }
+        mThreads[ stage ] = std::max( 1, (int)threads[ stage ].size() );
+    }
+
+    //Report once a second, the stages close their queues in turn when the generator stops
+    Uint64 reported = start;
+    bool running = true;
+    while( running )
+    {
+        SDL_Delay( 50 );
+        running = SDL_AtomicGet( &mStop ) == 0;
+        if( running && SDL_GetPerformanceCounter() - reported < SDL_GetPerformanceFrequency() )
+        {
+            continue;
+        }
+        reported = SDL_GetPerformanceCounter();
+
+        SDL_LockMutex( mMutex );
+        double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+        printf( "\rfarm: %d/%d written, %d rejected (%d near-duplicates), %.1f images/s |", mWritten, mCount, mRejected, mDuplicates,
+                ( mWritten - startWritten ) / seconds );
+        for( int stage = 0; stage < FARM_STAGES; ++stage )
+        {
+            double busy = (double)mBusy[ stage ] / SDL_GetPerformanceFrequency();
+            printf( " %s %.0f%%", names[ stage ], 100.0 * busy / ( seconds * mThreads[ stage ] ) );
+        }
+        printf( " | queued %d %d %d", mGenerated.getSize(), mAccepted.getSize(), mRendered.getSize() );
+        SDL_UnlockMutex( mMutex );
+        fflush( stdout );
+
+        saveCheckpoint();
+    }
+    printf( "\n" );
+
+    for( int stage = 0; stage < FARM_STAGES; ++stage )
+    {
+        for( size_t i = 0; i < threads[ stage ].size(); ++i )
+        {
+            SDL_WaitThread( threads[ stage ][ i ], NULL );
+        }
+    }
+    saveCheckpoint();
+
+    if( gProfiling )
+    {
+        printf( "evaluation profile across the batch:\n" );
+        printProfile( gProfile );
+    }
+
+    return mWritten >= mCount ? 0 : 1;
+}
+
+int ArtFarm::generateMain( void* data )
+{
+    ( (ArtFarm*)data )->generate();
+    return 0;
+}
+
+int ArtFarm::filterMain( void* data )
+{
+    flushSubnormals();
+    ( (ArtFarm*)data )->filter();
+    return 0;
+}
+
+int ArtFarm::renderMain( void* data )
+{
+    flushSubnormals();
+    ( (ArtFarm*)data )->render();
+    return 0;
+}
+
+int ArtFarm::writeMain( void* data )
+{
+    ( (ArtFarm*)data )->write();
+    return 0;
+}
+
+void ArtFarm::generate()
+{
+    while( SDL_AtomicGet( &mStop ) == 0 )
+    {
+        Uint64 start = SDL_GetPerformanceCounter();
+
+        //Remember where this candidate came from before drawing it
+        Snapshot snapshot;
+        snapshot.rng = mRng.state;
+        snapshot.parent = genomeToString( mParent );
+        SDL_LockMutex( mMutex );
+        mSnapshots[ mNextIndex ] = snapshot;
+        SDL_UnlockMutex( mMutex );
+
+        if( mNextIndex % FARM_LINEAGE == 0 )
+        {
+            deleteTree( mParent );
+            mParent = copyTree( mSeed );
+        }
+        FarmItem* item = new FarmItem();
+        item->index = mNextIndex++;
+        item->genome = mutateExpression( mParent, 0, &mRng );
+        deleteTree( mParent );
+        mParent = copyTree( item->genome );
+
+        addBusy( FARM_GENERATE, SDL_GetPerformanceCounter() - start );
+        if( !mGenerated.push( item ) )
+        {
+            discard( item );
+            break;
+        }
+    }
+
+    //Where to pick up again if the run stops here
+    Snapshot snapshot;
+    snapshot.rng = mRng.state;
+    snapshot.parent = genomeToString( mParent );
+    SDL_LockMutex( mMutex );
+    mSnapshots[ mNextIndex ] = snapshot;
+    SDL_UnlockMutex( mMutex );
+    mGenerated.close();
+}
+
+void ArtFarm::filter()
+{
+    while( FarmItem* item = mGenerated.pop() )
+    {
+        Uint64 start = SDL_GetPerformanceCounter();
+        bool boring = countStrikes( item->genome ) == 3 || isFlat( item->genome, DEFAULT_VIEW );
+        bool duplicate = false;
+        if( !boring && mDedupe >= 0 )
+        {
+            Uint64 hash = fingerprint( item->genome, DEFAULT_VIEW, mIndexScratch );
+            duplicate = mIndex.contains( hash, mDedupe );
+            if( !duplicate )
+            {
+                mIndex.insert( hash );
+            }
+        }
+        addBusy( FARM_FILTER, SDL_GetPerformanceCounter() - start );
+
+        if( SDL_AtomicGet( &mStop ) != 0 )
+        {
+            discard( item );
+        }
+        else if( boring || duplicate )
+        {
+            if( duplicate )
+            {
+                SDL_LockMutex( mMutex );
+                mDuplicates++;
+                SDL_UnlockMutex( mMutex );
+            }
+            finish( item, false );
+        }
+        else if( !mAccepted.push( item ) )
+        {
+            discard( item );
+        }
+    }
+    mAccepted.close();
+}
+
+void ArtFarm::render()
+{
+    SpanScratch scratch;
+    SDL_Rect whole = { 0, 0, mWidth, mHeight };
+    while( FarmItem* item = mAccepted.pop() )
+    {
+        if( SDL_AtomicGet( &mStop ) != 0 )
+        {
+            discard( item );
+            continue;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        item->pixels.resize( (size_t)mWidth * mHeight );
+        renderRegionAA( item->genome, mWidth, mHeight, DEFAULT_VIEW, whole, &item->pixels[ 0 ], mWidth, mAA, scratch );
+        flushProfile( scratch );
+        addBusy( FARM_RENDER, SDL_GetPerformanceCounter() - start );
+
+        if( !mRendered.push( item ) )
+        {
+            discard( item );
+        }
+    }
+
+    //The last renderer out closes the writers' queue
+    SDL_LockMutex( mMutex );
+    bool last = --mRenderers == 0;
+    SDL_UnlockMutex( mMutex );
+    if( last )
+    {
+        mRendered.close();
+    }
+}
+
+void ArtFarm::write()
+{
+    while( FarmItem* item = mRendered.pop() )
+    {
+        //Images past the count are left for the checkpoint to bring back
+        SDL_LockMutex( mMutex );
+        bool wanted = SDL_AtomicGet( &mStop ) == 0 && mClaimed < mCount;
+        mClaimed += wanted ? 1 : 0;
+        SDL_UnlockMutex( mMutex );
+        if( !wanted )
+        {
+            discard( item );
+            continue;
+        }
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        char name[ 32 ];
+        snprintf( name, sizeof( name ), "/art%06d", item->index );
+        std::string path = mDir + name;
+
+        PngWriter png;
+        bool success = png.open( path + ".png", mWidth, mHeight );
+        for( int y = 0; y < mHeight && success; ++y )
+        {
+            success = png.writeRow( &item->pixels[ (size_t)y * mWidth ] );
+        }
+        success = png.close() && success;
+        std::ofstream genome( ( path + ".txt" ).c_str() );
+        writeGenome( item->genome, genome );
+        genome << "\n";
+        success = success && genome.good();
+        addBusy( FARM_WRITE, SDL_GetPerformanceCounter() - start );
+
+        if( !success )
+        {
+            SDL_Log( "Unable to write %s!\n", path.c_str() );
+            SDL_AtomicSet( &mStop, 1 );
+        }
+        finish( item, success );
+    }
+}
+
+void ArtFarm::addBusy( int stage, Uint64 ticks )
+{
+    SDL_LockMutex( mMutex );
+    mBusy[ stage ] += ticks;
+    SDL_UnlockMutex( mMutex );
+}
+
+void ArtFarm::finish( FarmItem* item, bool written )
+{
+    SDL_LockMutex( mMutex );
+    if( written )
+    {
+        mWritten++;
+    }
+    else
+    {
+        mRejected++;
+    }
+    if( mWritten >= mCount )
+    {
+        SDL_AtomicSet( &mStop, 1 );
+    }
+
+    mFinished[ item->index ] = written;
+    while( !mFinished.empty() && mFinished.begin()->first == mCheckpoint )
+    {
+        mCheckpointWritten += mFinished.begin()->second ? 1 : 0;
+        mFinished.erase( mFinished.begin() );
+        mSnapshots.erase( mCheckpoint );
+        mCheckpoint++;
+    }
+    SDL_UnlockMutex( mMutex );
+
+    deleteTree( item->genome );
+    delete item;
+}
+
+void ArtFarm::discard( FarmItem* item )
+{
+    deleteTree( item->genome );
+    delete item;
+}
+
+void ArtFarm::saveCheckpoint()
+{
+    SDL_LockMutex( mMutex );
+    std::map<int, Snapshot>::iterator found = mSnapshots.find( mCheckpoint );
+    if( found == mSnapshots.end() )
+    {
+        SDL_UnlockMutex( mMutex );
+        return;
+    }
+    std::ostringstream out;
+    out << mCheckpoint << " " << mCheckpointWritten << " " << found->second.rng << "\n"
+        << mSeedText << "\n" << found->second.parent << "\n";
+    SDL_UnlockMutex( mMutex );
+
+    //Replace the old checkpoint in one step so a crash never leaves half of one
+    std::string path = mDir + "/farm.checkpoint";
+    std::string temporary = path + ".tmp";
+    std::ofstream file( temporary.c_str() );
+    file << out.str();
+    file.close();
+    if( !file.fail() )
+    {
+        rename( temporary.c_str(), path.c_str() );
+    }
+}
+
+void ArtFarm::rebuildIndex()
+{
+    if( mDedupe < 0 )
+    {
+        return;
+    }
+    for( int index = 0; index < mCheckpoint; ++index )
+    {
+        char name[ 32 ];
+        snprintf( name, sizeof( name ), "/art%06d.txt", index );
+        std::ifstream file( ( mDir + name ).c_str() );
+        Node* genome = file ? readGenome( file ) : NULL;
+        if( genome != NULL )
+        {
+            mIndex.insert( fingerprint( genome, DEFAULT_VIEW, mIndexScratch ) );
+            deleteTree( genome );
+        }
+    }
+}
+
+bool ArtFarm::loadCheckpoint()
+{
+    std::ifstream file( ( mDir + "/farm.checkpoint" ).c_str() );
+    int index, written;
+    Uint64 rng;
+    if( !( file >> index >> written >> rng ) )
+    {
+        return false;
+    }
+    Node* seed = readGenome( file );
+    Node* parent = seed != NULL ? readGenome( file ) : NULL;
+    if( parent == NULL )
+    {
+        SDL_Log( "Ignoring damaged checkpoint in %s!\n", mDir.c_str() );
+        if( seed != NULL ) deleteTree( seed );
+        return false;
+    }
+
+    mSeed = seed;
+    mParent = parent;
+    mRng.state = rng;
+    mNextIndex = index;
+    mCheckpoint = index;
+    mWritten = written;
+    mCheckpointWritten = written;
+    return true;
+}
+
+//Port coordinators listen on for workers by default
+const int COORDINATOR_PORT = 7171;
+
+/*
+ * Read exactly length bytes from a socket, starting with any already buffered by readLine
+ */
+bool readBytes(int socket, std::string& buffer, size_t length, std::vector<unsigned char>& out){
+    out.resize(length);
+    size_t have = std::min(length, buffer.size());
+    if (have > 0) memcpy(&out[0], buffer.data(), have);
+    buffer.erase(0, have);
+    while (have < length){
+        ssize_t got = recv(socket, &out[have], length - have, 0);
+        if (got <= 0){
+            return false;
+        }
+        have += got;
+    }
+    return true;
+}
+
+/*
+ * Connect to a coordinator and render the tiles it hands out on every core until it is done
+ */
+int runWorker(std::string host, int port){
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = NULL;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host.c_str(), service, &hints, &addresses) != 0){
+        SDL_Log("Unable to find %s!\n", host.c_str());
+        return 1;
+    }
+    int connection = -1;
+    for (addrinfo* address = addresses; address != NULL && connection < 0; address = address->ai_next){
+        connection = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (connection >= 0 && connect(connection, address->ai_addr, address->ai_addrlen) != 0){
+            ::close(connection);
+            connection = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (connection < 0){
+        SDL_Log("Unable to connect to %s:%d!\n", host.c_str(), port);
+        return 1;
+    }
+    int nodelay = 1;
+    setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    //The job comes first
+    std::string buffer;
+    std::string line;
+    std::string text;
+    RegionJob job;
+    job.key.view = DEFAULT_VIEW;
+    job.aa = NO_ANTI_ALIAS;
+    std::string command;
+    bool connected = readLine(connection, buffer, line) && readLine(connection, buffer, text);
+    if (connected){
+        std::istringstream in(line);
+        in >> command >> job.key.width >> job.key.height >> job.key.view.x >> job.key.view.y >> job.key.view.scale
+           >> job.aa.samples >> job.aa.threshold >> job.aa.budget;
+        connected = command == "JOB" && !in.fail() && job.key.width > 0 && job.key.height > 0 && checkAntiAlias(job.aa);
+
+        //Tiles are evaluated in the coordinator's mode, whatever this worker was started with
+        int canonical = 0;
+        in >> canonical;
+        gCanonical = canonical != 0;
+        flushSubnormals();
+    }
+    job.genome = connected ? preferBaked(genomeFromString(text)) : NULL;
+    if (job.genome == NULL){
+        SDL_Log("Coordinator sent a bad job!\n");
+        ::close(connection);
+        return 1;
+    }
+
+    TaskPool pool;
+    pool.init(SDL_GetCPUCount() - 1);
+    std::vector<unsigned char> rgb;
+    std::vector<unsigned char> compressed;
+    int tiles = 0;
+    while (sendLine(connection, "NEXT") && readLine(connection, buffer, line)){
+        std::istringstream in(line);
+        int id;
+        in >> command >> id >> job.key.region.x >> job.key.region.y >> job.key.region.w >> job.key.region.h;
+        if (command != "TILE" || in.fail()){
+            break;
+        }
+
+        //Anti-aliasing budgets its samples per region, so with it on the tile is rendered whole, just as
+        //--export renders it, and picks the same edges. Without it, it is split across the cores
+        SDL_Rect region = job.key.region;
+        job.tile = job.aa.samples > 0 ? std::max(region.w, region.h) : SERVICE_TILE;
+        job.across = (region.w + job.tile - 1) / job.tile;
+        job.pixels.resize(region.w * region.h);
+        pool.run(renderRegionTile, &job, job.across * ((region.h + job.tile - 1) / job.tile));
+
+        rgb.resize(region.w * region.h * 3);
+        for (int i = 0; i < region.w * region.h; i++){
+            rgb[i * 3] = job.pixels[i] >> 24;
+            rgb[i * 3 + 1] = job.pixels[i] >> 16;
+            rgb[i * 3 + 2] = job.pixels[i] >> 8;
+        }
+        uLongf length = compressBound(rgb.size());
+        compressed.resize(length);
+        compress2(&compressed[0], &length, &rgb[0], rgb.size(), 1);
+
+        std::ostringstream header;
+        header << "PIXELS " << id << " " << length;
+        if (!sendLine(connection, header.str()) || !sendAll(connection, &compressed[0], length)){
+            break;
+        }
+        tiles++;
+    }
+
+    pool.free();
+    deleteTree(job.genome);
+    ::close(connection);
+    printf("worker rendered %d tiles\n", tiles);
+    fflush(stdout);
+    return 0;
+}
+
+//One tile of a distributed render and the workers rendering it
+struct DistributedTile{
+    SDL_Rect rect;
+    std::vector<int> workers;
+};
+
+//Splits a render into tiles for worker processes connected over TCP and writes the image as bands complete.
+//Tiles of a lost worker go back in the queue, and idle workers re-render tiles slow workers still hold
+class TileCoordinator
+{
+public:
+
+    TileCoordinator();
+    ~TileCoordinator();
+
+    //Renders a genome into path on workers connecting to port, forking spawn of them locally first
+    int run( Node* genome, std::string path, int width, int height, View view, AntiAlias aa, int port, int spawn );
+
+private:
+    //A worker's connection and the coordinator serving it
+    struct Connection{
+        TileCoordinator* coordinator;
+        int socket;
+        int worker;
+    };
+
+    static int acceptMain( void* data );
+    static int serveMain( void* data );
+    void acceptWorkers();
+    void serve( Connection* connection );
+
+    //Waits for a tile for a worker, false once the render is finished
+    bool nextTile( int worker, int& id, SDL_Rect& rect );
+
+    //Copies a finished tile into its band, unless another worker got there first
+    void completeTile( int id, const std::vector<unsigned char>& compressed );
+
+    //Gives back the tiles a lost worker held
+    void abandon( int worker );
+
+    //Queues the tiles of a band
+    void addBand( int band );
+
+    int mListener;
+    int mWidth;
+    int mHeight;
+    int mAcross;
+    int mBands;
+    std::string mJob;
+
+    //Everything below is guarded by the mutex, tiles are dropped from mTiles when done
+    SDL_mutex* mMutex;
+    SDL_cond* mChanged;
+    bool mFinished;
+    std::map<int, DistributedTile> mTiles;
+    std::list<int> mQueue;
+    std::vector<Uint32> mPixels[ 2 ];
+    int mLeft[ 2 ];
+    int mWorkers;
+    std::vector<int> mSockets;
+    std::vector<SDL_Thread*> mThreads;
+};
+
+TileCoordinator::TileCoordinator()
+{
+    //Initialize
+    mListener = -1;
+    mWidth = 0;
+    mHeight = 0;
+    mAcross = 0;
+    mBands = 0;
+    mMutex = SDL_CreateMutex();
+    mChanged = SDL_CreateCond();
+    mFinished = false;
+    mLeft[ 0 ] = mLeft[ 1 ] = 0;
+    mWorkers = 0;
+}
+
+TileCoordinator::~TileCoordinator()
+{
+    //Deallocate
+    SDL_DestroyCond( mChanged );
+    SDL_DestroyMutex( mMutex );
+}
+
+int TileCoordinator::run( Node* genome, std::string path, int width, int height, View view, AntiAlias aa, int port, int spawn )
+{
+    PngWriter png;
+    MappedPpmWriter ppm;
+    ImageWriter* writer = chooseWriter( path, png, ppm );
+    if( writer == NULL || !writer->open( path, width, height ) )
+    {
+        return 1;
+    }
+
+    sockaddr_in address;
+    memset( &address, 0, sizeof( address ) );
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl( INADDR_ANY );
+    address.sin_port = htons( port );
+    int reuse = 1;
+    mListener = socket( AF_INET, SOCK_STREAM, 0 );
+    if( mListener < 0 || setsockopt( mListener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) ) != 0 ||
+        bind( mListener, (sockaddr*)&address, sizeof( address ) ) != 0 || listen( mListener, 64 ) != 0 )
+    {
+        SDL_Log( "Unable to listen on port %d!\n", port );
+        if( mListener >= 0 ) ::close( mListener );
+        return 1;
+    }
+
+    //Every worker is sent the whole job when it connects
+    char numbers[ 256 ];
+    snprintf( numbers, sizeof( numbers ), "JOB %d %d %.17g %.17g %.17g %d %d %.17g %d\n", width, height, view.x, view.y, view.scale, aa.samples, aa.threshold, aa.budget, gCanonical ? 1 : 0 );
+    mJob = numbers + genomeToString( genome ) + "\n";
+    mWidth = width;
+    mHeight = height;
+    mAcross = ( width + EXPORT_TILE - 1 ) / EXPORT_TILE;
+    mBands = ( height + EXPORT_TILE - 1 ) / EXPORT_TILE;
+
+    //Local workers are forked before any thread starts
+    std::vector<pid_t> children;
+    for( int i = 0; i < spawn; ++i )
+    {
+        pid_t child = fork();
+        if( child == 0 )
+        {
+            ::close( mListener );
+            _exit( runWorker( "127.0.0.1", port ) );
+        }
+        if( child > 0 )
+        {
+            children.push_back( child );
+        }
+    }
+
+    printf( "coordinating %d tiles on port %d\n", mAcross * mBands, port );
+    fflush( stdout );
+    SDL_LockMutex( mMutex );
+    mPixels[ 0 ].resize( (size_t)width * EXPORT_TILE );
+    mPixels[ 1 ].resize( (size_t)width * EXPORT_TILE );
+    addBand( 0 );
+    if( mBands > 1 )
+    {
+        addBand( 1 );
+    }
+    SDL_UnlockMutex( mMutex );
+    SDL_Thread* acceptor = SDL_CreateThread( acceptMain, "TileAcceptor", this );
+
+    //Write bands in order as their tiles arrive, queueing the band after next in the freed buffer
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool success = acceptor != NULL;
+    for( int band = 0; band < mBands && success; ++band )
+    {
+        SDL_LockMutex( mMutex );
+        while( mLeft[ band % 2 ] > 0 )
+        {
+            SDL_CondWait( mChanged, mMutex );
+        }
+        int workers = mWorkers;
+        SDL_UnlockMutex( mMutex );
+
+        int rows = std::min( EXPORT_TILE, height - band * EXPORT_TILE );
+        for( int y = 0; y < rows && success; ++y )
+        {
+            success = writer->writeRow( &mPixels[ band % 2 ][ (size_t)y * width ] );
+        }
+
+        SDL_LockMutex( mMutex );
+        if( band + 2 < mBands )
+        {
+            addBand( band + 2 );
+        }
+        SDL_UnlockMutex( mMutex );
+
+        double seconds = (double)( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+        int done = band * EXPORT_TILE + rows;
+        printf( "\rcoordinate: %d/%d rows, %.2f Mpixel/s, %d workers", done, height, (double)done * width / seconds / 1e6, workers );
+        fflush( stdout );
+    }
+    printf( "\n" );
+
+    //Wake and disconnect everyone, then wait for the threads and local workers
+    SDL_LockMutex( mMutex );
+    mFinished = true;
+    SDL_CondBroadcast( mChanged );
+    shutdown( mListener, SHUT_RDWR );
+    for( size_t i = 0; i < mSockets.size(); ++i )
+    {
+        if( mSockets[ i ] >= 0 )
+        {
+            shutdown( mSockets[ i ], SHUT_RDWR );
+        }
+    }
+    SDL_UnlockMutex( mMutex );
+    if( acceptor != NULL )
+    {
+        SDL_WaitThread( acceptor, NULL );
+    }
+    for( size_t i = 0; i < mThreads.size(); ++i )
+    {
+        SDL_WaitThread( mThreads[ i ], NULL );
+    }
+    ::close( mListener );
+    for( size_t i = 0; i < children.size(); ++i )
+    {
+        waitpid( children[ i ], NULL, 0 );
+    }
+
+    success = writer->close() && success;
+    return success ? 0 : 1;
+}
+
+int TileCoordinator::acceptMain( void* data )
+{
+    ( (TileCoordinator*)data )->acceptWorkers();
+    return 0;
+}
+
+int TileCoordinator::serveMain( void* data )
+{
+    Connection* connection = (Connection*)data;
+    connection->coordinator->serve( connection );
+    return 0;
+}
+
+void TileCoordinator::acceptWorkers()
+{
+    while( true )
+    {
+        int socket = accept( mListener, NULL, NULL );
+
+        SDL_LockMutex( mMutex );
+        if( mFinished )
+        {
+            SDL_UnlockMutex( mMutex );
+            if( socket >= 0 ) ::close( socket );
+            return;
+        }
+        if( socket < 0 )
+        {
+            SDL_UnlockMutex( mMutex );
+            continue;
+        }
+        int nodelay = 1;
+        setsockopt( socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof( nodelay ) );
+
+        Connection* connection = new Connection();
+        connection->coordinator = this;
+        connection->socket = socket;
+        connection->worker = mSockets.size();
+        SDL_Thread* thread = SDL_CreateThread( serveMain, "TileServer", connection );
+        if( thread == NULL )
+        {
+            ::close( socket );
+            delete connection;
+        }
+        else
+        {
+            mSockets.push_back( socket );
+            mThreads.push_back( thread );
+            mWorkers++;
+        }
+        SDL_UnlockMutex( mMutex );
+    }
+}
+
+/*
+ * Each worker is sent the job, then repeatedly asks for a tile and sends back its pixels:
+ *   -> JOB <width> <height> <x> <y> <scale> <aa samples> <aa threshold> <aa budget> <canonical 0|1>  then the genome
+ *   <- NEXT   -> TILE <id> <x> <y> <w> <h>, or DONE when the render is finished
+ *   <- PIXELS <id> <bytes>  then the tile's RGB rows, zlib compressed
+ */
+void TileCoordinator::serve( Connection* connection )
+{
+    std::string buffer;
+    std::string line;
+    std::vector<unsigned char> compressed;
+    bool connected = sendLine( connection->socket, mJob.substr( 0, mJob.size() - 1 ) );
+
+    while( connected && readLine( connection->socket, buffer, line ) )
+    {
+        std::istringstream in( line );
+        std::string command;
+        in >> command;
+
+        if( command == "NEXT" )
+        {
+            int id;
+            SDL_Rect rect;
+            if( !nextTile( connection->worker, id, rect ) )
+            {
+                sendLine( connection->socket, "DONE" );
+                break;
+            }
+            std::ostringstream tile;
+            tile << "TILE " << id << " " << rect.x << " " << rect.y << " " << rect.w << " " << rect.h;
+            connected = sendLine( connection->socket, tile.str() );
+        }
+        else if( command == "PIXELS" )
+        {
+            int id = -1;
+            size_t bytes = 0;
+            in >> id >> bytes;
+
+            //The port is open to any host, so no tile may claim more than a whole compressed tile
+            connected = !in.fail() && bytes <= compressBound( EXPORT_TILE * EXPORT_TILE * 3 ) &&
+                        readBytes( connection->socket, buffer, bytes, compressed );
+            if( connected )
+            {
+                completeTile( id, compressed );
+            }
+        }
+        else
+        {
+            connected = false;
+        }
+    }
+
+    abandon( connection->worker );
+    SDL_LockMutex( mMutex );
+    mSockets[ connection->worker ] = -1;
+    SDL_UnlockMutex( mMutex );
+    ::close( connection->socket );
+    delete connection;
+}
+
+bool TileCoordinator::nextTile( int worker, int& id, SDL_Rect& rect )
+{
+    SDL_LockMutex( mMutex );
+    while( !mFinished )
+    {
+        //Fresh tiles first
+        if( !mQueue.empty() )
+        {
+            id = mQueue.front();
+            mQueue.pop_front();
+            break;
+        }
+
+        //Otherwise help with the oldest tile still out with a single worker
+        id = -1;
+        for( std::map<int, DistributedTile>::iterator tile = mTiles.begin(); tile != mTiles.end(); ++tile )
+        {
+            if( tile->second.workers.size() == 1 && tile->second.workers[ 0 ] != worker )
+            {
+                id = tile->first;
+                break;
+            }
+        }
+        if( id >= 0 )
+        {
+            break;
+        }
+        SDL_CondWait( mChanged, mMutex );
+    }
+
+    bool found = !mFinished;
+    if( found )
+    {
+        mTiles[ id ].workers.push_back( worker );
+        rect = mTiles[ id ].rect;
+    }
+    SDL_UnlockMutex( mMutex );
+
+    return found;
+}
+
+void TileCoordinator::completeTile( int id, const std::vector<unsigned char>& compressed )
+{
+    SDL_LockMutex( mMutex );
+    std::map<int, DistributedTile>::iterator found = mTiles.find( id );
+    if( found == mTiles.end() )
+    {
+        SDL_UnlockMutex( mMutex );
+        return;
+    }
+    SDL_Rect rect = found->second.rect;
+    SDL_UnlockMutex( mMutex );
+
+    //Decompress outside the lock, a broken block leaves the tile to someone else
+    std::vector<unsigned char> rgb( rect.w * rect.h * 3 );
+    uLongf length = rgb.size();
+    if( compressed.empty() || uncompress( &rgb[ 0 ], &length, &compressed[ 0 ], compressed.size() ) != Z_OK || length != rgb.size() )
+    {
+        SDL_Log( "Discarding a damaged block for tile %d!\n", id );
+        return;
+    }
+
+    SDL_LockMutex( mMutex );
+    found = mTiles.find( id );
+    if( found != mTiles.end() )
+    {
+        int slot = ( rect.y / EXPORT_TILE ) % 2;
+        for( int y = 0; y < rect.h; ++y )
+        {
+            Uint32* out = &mPixels[ slot ][ (size_t)( rect.y % EXPORT_TILE + y ) * mWidth + rect.x ];
+            const unsigned char* in = &rgb[ y * rect.w * 3 ];
+            for( int x = 0; x < rect.w; ++x )
+            {
+                out[ x ] = (Uint32)in[ x * 3 ] << 24 | (Uint32)in[ x * 3 + 1 ] << 16 | (Uint32)in[ x * 3 + 2 ] << 8 | 0xFF;
+            }
+        }
+        mTiles.erase( found );
+        mLeft[ slot ]--;
+        SDL_CondBroadcast( mChanged );
+    }
+    SDL_UnlockMutex( mMutex );
+}
+
+void TileCoordinator::abandon( int worker )
+{
+    SDL_LockMutex( mMutex );
+    for( std::map<int, DistributedTile>::iterator tile = mTiles.begin(); tile != mTiles.end(); ++tile )
+    {
+        std::vector<int>& workers = tile->second.workers;
+        std::vector<int>::iterator held = std::find( workers.begin(), workers.end(), worker );
+        if( held == workers.end() )
+        {
+            continue;
+        }
+        workers.erase( held );
+        if( workers.empty() )
+        {
+            mQueue.push_front( tile->first );
+        }
+    }
+    mWorkers--;
+    SDL_CondBroadcast( mChanged );
+    SDL_UnlockMutex( mMutex );
+}
+
+void TileCoordinator::addBand( int band )
+{
+    int rows = std::min( EXPORT_TILE, mHeight - band * EXPORT_TILE );
+    for( int column = 0; column < mAcross; ++column )
+    {
+        int id = band * mAcross + column;
+        DistributedTile tile;
+        SDL_Rect rect = { column * EXPORT_TILE, band * EXPORT_TILE, std::min( EXPORT_TILE, mWidth - column * EXPORT_TILE ), rows };
+        tile.rect = rect;
+        mTiles[ id ] = tile;
+        mQueue.push_back( id );
+    }
+    mLeft[ band % 2 ] = mAcross;
+    SDL_CondBroadcast( mChanged );
+}
+
+//Header of each generation in a lineage journal, followed by the path and the genome text
+struct JournalRecord{
+    Sint64 parent;          //generation it was mutated from, -1 for none
+    Uint32 depth;           //changes back to the nearest full snapshot, 0 for a snapshot
+    Uint32 pathLength;      //child indices from the root down to the changed subtree
+    Uint32 textLength;      //the new subtree, as genome text
+    Uint32 check;           //JOURNAL_CHECK, so a torn write is not mistaken for a record
+};
+
+const Uint32 JOURNAL_CHECK = 0x4C696E65;
+
+//A generation is stored whole once it is this many changes from the last whole one
+const int JOURNAL_SNAPSHOT_EVERY = 64;
+
+//Maps reach this far past the end of a file, so appending rarely means mapping it again
+const size_t JOURNAL_MAP_SLACK = 16 << 20;
+
+/*
+ * Whether two nodes match, ignoring their children
+ */
+bool sameNode(Node* a, Node* b){
+    if (a == NULL || b == NULL){
+        return a == b;
+    }
+    if (a->kind != b->kind){
+        return false;
+    }
+    if (a->kind == NUMBER){
+        return bitsOf(a->number) == bitsOf(b->number);
+    }
+    return a->kind == VECTOR || a->op == b->op;
+}
+
+/*
+ * Children of a node in path order: left and right, or r, g and b. Returns how many
+ */
+int childSlots(Node* prev, Node** slots[3]){
+    if (prev->kind == OPERATOR){
+        slots[0] = &prev->left;
+        slots[1] = &prev->right;
+        return 2;
+    }
+    if (prev->kind == VECTOR){
+        slots[0] = &prev->r;
+        slots[1] = &prev->g;
+        slots[2] = &prev->b;
+        return 3;
+    }
+    return 0;
+}
+
+bool sameTree(Node* a, Node* b){
+    if (!sameNode(a, b)){
+        return false;
+    }
+    if (a == NULL){
+        return true;
+    }
+    Node** left[3];
+    Node** right[3];
+    int count = childSlots(a, left);
+    childSlots(b, right);
+    for (int n = 0; n < count; n++){
+        if (!sameTree(*left[n], *right[n])){
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Smallest subtree of child holding every difference from parent, and the path down to it.
+ * NULL when the trees are the same
+ */
+Node* findChange(Node* parent, Node* child, std::string& path){
+    if (!sameNode(parent, child)){
+        return child;
+    }
+    if (child == NULL){
+        return NULL;
+    }
+    Node** before[3];
+    Node** after[3];
+    int count = childSlots(parent, before);
+    childSlots(child, after);
+    int changed = -1;
+    for (int n = 0; n < count; n++){
+        if (!sameTree(*before[n], *after[n])){
+            if (changed >= 0){
+                return child;
+            }
+            changed = n;
+        }
+    }
+    if (changed < 0){
+        return NULL;
+    }
+    path += (char)changed;
+    Node* site = findChange(*before[changed], *after[changed], path);
+    return site != NULL ? site : child;
+}
+
+//Every generation of root, appended as the change from the generation it came from, with a whole
+//snapshot every so often. Read back through memory maps, so loading a generation only touches its chain.
+class LineageJournal
+{
+public:
+
+    LineageJournal();
+    ~LineageJournal();
+
+    //Opens the journal at path, and its index of record offsets at path.idx, creating them if needed
+    bool open( std::string path );
+
+    //Records child as the next generation, mutated from generation parent whose tree is parentTree.
+    //Returns the new generation, or -1 if it could not be written
+    Sint64 append( Sint64 parent, Node* parentTree, Node* child );
+
+    //Rebuilds a generation from its nearest snapshot and the changes since, NULL if it can't
+    Node* load( Sint64 generation );
+
+    //The generation one came from, -1 for the first, fresh starts and unknown generations
+    Sint64 getParent( Sint64 generation );
+
+    //Number of generations recorded
+    Sint64 getCount();
+
+    void close();
+
+private:
+    //The record of a generation, with its path and text, NULL if unknown or damaged
+    const JournalRecord* getRecord( Sint64 generation, const char** path, const char** text );
+
+    //Maps enough of a file to reach length bytes
+    bool mapFile( int file, Uint64 length, unsigned char** map, size_t* mapLength );
+
+    int mFile;
+    int mIndexFile;
+    Sint64 mCount;
+    Uint64 mLength;
+
+    unsigned char* mMap;
+    size_t mMapLength;
+    unsigned char* mIndexMap;
+    size_t mIndexMapLength;
+};
+
+LineageJournal::LineageJournal()
+{
+    //Initialize
+    mFile = -1;
+    mIndexFile = -1;
+    mCount = 0;
+    mLength = 0;
+    mMap = NULL;
+    mMapLength = 0;
+    mIndexMap = NULL;
+    mIndexMapLength = 0;
+}
+
+LineageJournal::~LineageJournal()
+{
+    //Deallocate
+    close();
+}
+
+bool LineageJournal::open( std::string path )
+{
+    close();
+    mFile = ::open( path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644 );
+    mIndexFile = ::open( ( path + ".idx" ).c_str(), O_RDWR | O_CREAT | O_APPEND, 0644 );
+    struct stat journal, index;
+    if( mFile < 0 || mIndexFile < 0 || fstat( mFile, &journal ) != 0 || fstat( mIndexFile, &index ) != 0 )
+    {
+        SDL_Log( "Unable to open journal %s!\n", path.c_str() );
+        close();
+        return false;
+    }
+    mLength = journal.st_size;
+    mCount = index.st_size / sizeof( Uint64 );
+
+    //Drop index entries whose records never made it to disk whole
+    while( mCount > 0 && getRecord( mCount - 1, NULL, NULL ) == NULL )
+    {
+        mCount--;
+    }
+    if( (Uint64)index.st_size != mCount * sizeof( Uint64 ) && ftruncate( mIndexFile, mCount * sizeof( Uint64 ) ) != 0 )
+    {
+        SDL_Log( "Unable to repair journal index %s.idx!\n", path.c_str() );
+        close();
+        return false;
+    }
+
+    //Cut off whatever follows the last whole record, so the next one starts 8 byte aligned where the index says
+    Uint64 end = 0;
+    if( mCount > 0 )
+    {
+        const char* text;
+        const JournalRecord* record = getRecord( mCount - 1, NULL, &text );
+        end = ( (const unsigned char*)text - mMap + record->textLength + 7 ) / 8 * 8;
+    }
+    if( end != mLength )
+    {
+        if( ftruncate( mFile, end ) != 0 )
+        {
+            SDL_Log( "Unable to repair journal %s!\n", path.c_str() );
+            close();
+            return false;
+        }
+        mLength = end;
+    }
+
+    return true;
+}
+
+Sint64 LineageJournal::append( Sint64 parent, Node* parentTree, Node* child )
+{
+    if( mFile < 0 )
+    {
+        return -1;
+    }
+
+    //Store only the subtree that changed, unless the chain back to a snapshot is long enough
+    JournalRecord record;
+    record.parent = parent >= 0 && parent < mCount ? parent : -1;
+    record.check = JOURNAL_CHECK;
+    std::string path;
+    Node* site = child;
+    const JournalRecord* before = record.parent >= 0 ? getRecord( record.parent, NULL, NULL ) : NULL;
+    if( before != NULL && parentTree != NULL && before->depth + 1 < JOURNAL_SNAPSHOT_EVERY )
+    {
+        site = findChange( parentTree, child, path );
+        if( site == NULL )
+        {
+            path.clear();
+            site = child;
+        }
+    }
+    record.depth = path.empty() ? 0 : before->depth + 1;
+    std::string text = genomeToString( site );
+    record.pathLength = path.size();
+    record.textLength = text.size();
+
+    //Records are padded so every header starts 8 byte aligned
+    std::string bytes( (const char*)&record, sizeof( record ) );
+    bytes += path;
+    bytes += text;
+    bytes.resize( ( bytes.size() + 7 ) / 8 * 8, '\0' );
+    //A write that fails part way is cut back off, so the files still end where mLength and mCount say
+    Uint64 offset = mLength;
+    if( write( mFile, bytes.data(), bytes.size() ) != (ssize_t)bytes.size() )
+    {
+        SDL_Log( "Unable to write journal!\n" );
+        if( ftruncate( mFile, offset ) != 0 )
+        {
+            close();
+        }
+        return -1;
+    }
+    mLength += bytes.size();
+    if( write( mIndexFile, &offset, sizeof( offset ) ) != sizeof( offset ) )
+    {
+        SDL_Log( "Unable to write journal index!\n" );
+        mLength = offset;
+        if( ftruncate( mIndexFile, mCount * sizeof( Uint64 ) ) != 0 || ftruncate( mFile, offset ) != 0 )
+        {
+            close();
+        }
+        return -1;
+    }
+
+    return mCount++;
+}
+
+Node* LineageJournal::load( Sint64 generation )
+{
+    //Walk back to the snapshot, then replay the changes forward
+    std::vector<Sint64> chain;
+    const JournalRecord* record = NULL;
+    const char* path;
+    const char* text;
+    while( true )
+    {
+        record = getRecord( generation, &path, &text );
+        if( record == NULL )
+        {
+            return NULL;
+        }
+        chain.push_back( generation );
+        if( record->depth == 0 )
+        {
+            break;
+        }
+        const JournalRecord* parent = getRecord( record->parent, NULL, NULL );
+        if( parent == NULL || record->parent >= generation || parent->depth + 1 != record->depth )
+        {
+            SDL_Log( "Journal chain of generation %lld is damaged!\n", (long long)chain[ 0 ] );
+            return NULL;
+        }
+        generation = record->parent;
+    }
+
+    Node* tree = genomeFromString( std::string( text, record->textLength ) );
+    for( int n = (int)chain.size() - 2; n >= 0 && tree != NULL; --n )
+    {
+        record = getRecord( chain[ n ], &path, &text );
+        Node* site = genomeFromString( std::string( text, record->textLength ) );
+        Node** slot = &tree;
+        for( Uint32 i = 0; i < record->pathLength && site != NULL; ++i )
+        {
+            Node** slots[ 3 ];
+            int count = childSlots( *slot, slots );
+            if( (unsigned char)path[ i ] >= count || *slots[ (unsigned char)path[ i ] ] == NULL )
+            {
+                deleteTree( site );
+                site = NULL;
+                break;
+            }
+            slot = slots[ (unsigned char)path[ i ] ];
+        }
+        if( site == NULL )
+        {
+            SDL_Log( "Journal change of generation %lld doesn't fit its parent!\n", (long long)chain[ n ] );
+            deleteTree( tree );
+            return NULL;
+        }
+        deleteTree( *slot );
+        *slot = site;
+    }
+
+    return tree;
+}
+
+Sint64 LineageJournal::getParent( Sint64 generation )
+{
+    const JournalRecord* record = getRecord( generation, NULL, NULL );
+    return record != NULL ? record->parent : -1;
+}
+
+Sint64 LineageJournal::getCount()
+{
+    return mCount;
+}
+
+void LineageJournal::close()
+{
+    if( mMap != NULL )
+    {
+        munmap( mMap, mMapLength );
+        mMap = NULL;
+        mMapLength = 0;
+    }
+    if( mIndexMap != NULL )
+    {
+        munmap( mIndexMap, mIndexMapLength );
+        mIndexMap = NULL;
+        mIndexMapLength = 0;
+    }
+    if( mFile >= 0 )
+    {
+        ::close( mFile );
+        mFile = -1;
+    }
+    if( mIndexFile >= 0 )
+    {
+        ::close( mIndexFile );
+        mIndexFile = -1;
+    }
+    mCount = 0;
+    mLength = 0;
+}
+
+const JournalRecord* LineageJournal::getRecord( Sint64 generation, const char** path, const char** text )
+{
+    if( generation < 0 || generation >= mCount || !mapFile( mIndexFile, ( generation + 1 ) * sizeof( Uint64 ), &mIndexMap, &mIndexMapLength ) )
+    {
+        return NULL;
+    }
+    Uint64 offset;
+    memcpy( &offset, mIndexMap + generation * sizeof( Uint64 ), sizeof( offset ) );
+    if( offset % 8 != 0 || offset + sizeof( JournalRecord ) > mLength || !mapFile( mFile, offset + sizeof( JournalRecord ), &mMap, &mMapLength ) )
+    {
+        return NULL;
+    }
+
+    const JournalRecord* record = (const JournalRecord*)( mMap + offset );
+    Uint64 end = offset + sizeof( JournalRecord ) + record->pathLength + record->textLength;
+    if( record->check != JOURNAL_CHECK || end > mLength || !mapFile( mFile, end, &mMap, &mMapLength ) )
+    {
+        return NULL;
+    }
+    record = (const JournalRecord*)( mMap + offset );
+    if( path != NULL ) *path = (const char*)( record + 1 );
+    if( text != NULL ) *text = (const char*)( record + 1 ) + record->pathLength;
+    return record;
+}
+
+bool LineageJournal::mapFile( int file, Uint64 length, unsigned char** map, size_t* mapLength )
+{
+    if( *map != NULL && length <= *mapLength )
+    {
+        return true;
+    }
+    if( *map != NULL )
+    {
+        munmap( *map, *mapLength );
+        *map = NULL;
+    }
+
+    //Pages past the end of the file are only touched once appends have filled them
+    size_t wanted = length + JOURNAL_MAP_SLACK;
+    void* mapped = mmap( NULL, wanted, PROT_READ, MAP_SHARED, file, 0 );
+    if( mapped == MAP_FAILED )
+    {
+        SDL_Log( "Unable to map journal!\n" );
+        *mapLength = 0;
+        return false;
+    }
+    *map = (unsigned char*)mapped;
+    *mapLength = wanted;
+    return true;
+}
+
+//Journal of the app's generations, and the generation root is
+LineageJournal gJournal;
+Sint64 gGeneration = -1;
+
+/*
+ * Record that root is about to become child
+ */
+void recordGeneration(Node* child){
+    Sint64 generation = gJournal.append(gGeneration, root, child);
+    if (generation >= 0){
+        gGeneration = generation;
+    }
+}
+
+//A root the user moved away from, and its journal generation
+struct HistoryEntry{
+    Node* genome;
+    Sint64 generation;
+};
+
+//Most roots kept for undo. Trees share structure, so each costs little more than what changed
+const int HISTORY_LIMIT = 256;
+
+std::vector<HistoryEntry> gUndo;
+std::vector<HistoryEntry> gRedo;
+
+void clearHistory(std::vector<HistoryEntry>& history){
+    for (size_t n = 0; n < history.size(); n++){
+        deleteTree(history[n].genome);
+    }
+    history.clear();
+}
+
+/*
+ * Make child the root, journaling it and keeping the old root to undo back to
+ */
+void setRoot(Node* child){
+    HistoryEntry entry = { root, gGeneration };
+    recordGeneration(child);
+    gUndo.push_back(entry);
+    if (gUndo.size() > HISTORY_LIMIT){
+        deleteTree(gUndo[0].genome);
+        gUndo.erase(gUndo.begin());
+    }
+    clearHistory(gRedo);
+    root = child;
+}
+
+/*
+ * Step root back through one history and onto the other, false if there is nothing to step to
+ */
+bool stepHistory(std::vector<HistoryEntry>& from, std::vector<HistoryEntry>& to){
+    if (from.empty()){
+        return false;
+    }
+    HistoryEntry entry = { root, gGeneration };
+    to.push_back(entry);
+    root = from.back().genome;
+    gGeneration = from.back().generation;
+    from.pop_back();
+    return true;
+}
+
+//Thumbnails are square, packed ATLAS_COLUMNS across and down into fixed-size pages of the atlas file
+const int THUMB_SIZE = 128;
+const int ATLAS_COLUMNS = 8;
+const int ATLAS_PAGE_THUMBS = ATLAS_COLUMNS * ATLAS_COLUMNS;
+const int ATLAS_PAGE_WIDTH = THUMB_SIZE * ATLAS_COLUMNS;
+const size_t ATLAS_PAGE_BYTES = (size_t)ATLAS_PAGE_WIDTH * ATLAS_PAGE_WIDTH * 4;
+
+//Most thumbnails waiting to render, the oldest requests are dropped first
+const int ATLAS_QUEUE = 256;
+
+//An atlas index entry, which slot holds the thumbnail of a genome hash
+struct AtlasEntry{
+    Uint64 hash;
+    Uint32 slot;
+    Uint32 check;           //ATLAS_CHECK, so a torn write is not mistaken for an entry
+};
+
+const Uint32 ATLAS_CHECK = 0x5468756D;
+
+//Slot find reports for a thumbnail that couldn't be stored, it isn't queued again
+const int ATLAS_FAILED = -2;
+
+//On-disk cache of genome thumbnails: pages of the atlas file are memory mapped as they are
+//needed, and a background thread renders the thumbnails that are missing
+class ThumbnailAtlas
+{
+public:
+
+    ThumbnailAtlas();
+    ~ThumbnailAtlas();
+
+    //Opens or creates path.atlas and path.index, and starts the rendering thread
+    bool open( std::string path );
+
+    //Slot holding a genome's thumbnail, -1 after queueing a copy of the genome to render,
+    //or ATLAS_FAILED if the atlas couldn't store it
+    int find( Uint64 hash, Node* genome );
+
+    //Pixels of the thumbnail in a slot, rows ATLAS_PAGE_WIDTH pixels apart
+    const Uint32* getPixels( int slot );
+
+    //Thumbnails queued or rendering
+    int getPending();
+
+    //Stops the rendering thread and unmaps the pages
+    void close();
+
+private:
+    static int workerMain( void* data );
+    void workerLoop();
+
+    //Maps a page, growing the file to hold it, needs the mutex
+    Uint32* mapPage( int page );
+
+    int mAtlasFile;
+    int mIndexFile;
+    std::map<Uint64, int> mSlots;
+    std::vector<Uint32*> mPages;
+    int mNextSlot;
+
+    //Genomes waiting for a thumbnail, newest first since those are the ones on screen
+    std::list< std::pair<Uint64, Node*> > mQueue;
+    int mRendering;
+    Uint64 mRenderingHash;
+
+    SDL_Thread* mThread;
+    SDL_mutex* mMutex;
+    SDL_cond* mWork;
+    bool mQuit;
+};
+
+ThumbnailAtlas::ThumbnailAtlas()
+{
+    //Initialize
+    mAtlasFile = -1;
+    mIndexFile = -1;
+    mNextSlot = 0;
+    mRendering = 0;
+    mRenderingHash = 0;
+    mThread = NULL;
+    mMutex = SDL_CreateMutex();
+    mWork = SDL_CreateCond();
+    mQuit = false;
+}
+
+ThumbnailAtlas::~ThumbnailAtlas()
+{
+    //Deallocate
+    close();
+    SDL_DestroyCond( mWork );
+    SDL_DestroyMutex( mMutex );
+}
+
+bool ThumbnailAtlas::open( std::string path )
+{
+    close();
+    mAtlasFile = ::open( ( path + ".atlas" ).c_str(), O_RDWR | O_CREAT, 0644 );
+    mIndexFile = ::open( ( path + ".index" ).c_str(), O_RDWR | O_CREAT | O_APPEND, 0644 );
+    if( mAtlasFile < 0 || mIndexFile < 0 )
+    {
+        SDL_Log( "Unable to open thumbnail cache %s!\n", path.c_str() );
+        close();
+        return false;
+    }
+
+    //The index is small, read it whole and drop a torn entry at the end
+    std::vector<AtlasEntry> entries;
+    AtlasEntry entry;
+    while( read( mIndexFile, &entry, sizeof( entry ) ) == sizeof( entry ) )
+    {
+        entries.push_back( entry );
+    }
+    if( ftruncate( mIndexFile, entries.size() * sizeof( AtlasEntry ) ) != 0 )
+    {
+        SDL_Log( "Unable to repair thumbnail index %s.index!\n", path.c_str() );
+    }
+    for( size_t i = 0; i < entries.size(); ++i )
+    {
+        if( entries[ i ].check == ATLAS_CHECK )
+        {
+            mSlots[ entries[ i ].hash ] = entries[ i ].slot;
+            mNextSlot = std::max( mNextSlot, (int)entries[ i ].slot + 1 );
+        }
+    }
+
+    mQuit = false;
+    mThread = SDL_CreateThread( workerMain, "ThumbnailWorker", this );
+    if( mThread == NULL )
+    {
+        SDL_Log( "Unable to create thumbnail thread! SDL Error: %s\n", SDL_GetError() );
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+int ThumbnailAtlas::find( Uint64 hash, Node* genome )
+{
+    SDL_LockMutex( mMutex );
+    std::map<Uint64, int>::iterator found = mSlots.find( hash );
+    if( found != mSlots.end() )
+    {
+        int slot = found->second;
+        SDL_UnlockMutex( mMutex );
+        return slot;
+    }
+
+    bool queued = mRendering > 0 && mRenderingHash == hash;
+    for( std::list< std::pair<Uint64, Node*> >::iterator i = mQueue.begin(); i != mQueue.end() && !queued; ++i )
+    {
+        queued = i->first == hash;
+    }
+    if( !queued && mThread != NULL )
+    {
+        mQueue.push_front( std::make_pair( hash, copyTree( genome ) ) );
+        if( mQueue.size() > ATLAS_QUEUE )
+        {
+            deleteTree( mQueue.back().second );
+            mQueue.pop_back();
+        }
+        SDL_CondSignal( mWork );
+    }
+    SDL_UnlockMutex( mMutex );
+
+    return -1;
+}
+
+const Uint32* ThumbnailAtlas::getPixels( int slot )
+{
+    SDL_LockMutex( mMutex );
+    Uint32* page = mapPage( slot / ATLAS_PAGE_THUMBS );
+    SDL_UnlockMutex( mMutex );
+    if( page == NULL )
+    {
+        return NULL;
+    }
+
+    int cell = slot % ATLAS_PAGE_THUMBS;
+    return page + ( cell / ATLAS_COLUMNS ) * THUMB_SIZE * ATLAS_PAGE_WIDTH + ( cell % ATLAS_COLUMNS ) * THUMB_SIZE;
+}
+
+int ThumbnailAtlas::getPending()
+{
+    SDL_LockMutex( mMutex );
+    int pending = mQueue.size() + mRendering;
+    SDL_UnlockMutex( mMutex );
+    return pending;
+}
+
+void ThumbnailAtlas::close()
+{
+    SDL_LockMutex( mMutex );
+    mQuit = true;
+    SDL_CondBroadcast( mWork );
+    SDL_UnlockMutex( mMutex );
+    if( mThread != NULL )
+    {
+        SDL_WaitThread( mThread, NULL );
+        mThread = NULL;
+    }
+
+    while( !mQueue.empty() )
+    {
+        deleteTree( mQueue.front().second );
+        mQueue.pop_front();
+    }
+    for( size_t i = 0; i < mPages.size(); ++i )
+    {
+        if( mPages[ i ] != NULL )
+        {
+            munmap( mPages[ i ], ATLAS_PAGE_BYTES );
+        }
+    }
+    mPages.clear();
+    mSlots.clear();
+    mNextSlot = 0;
+    if( mAtlasFile >= 0 )
+    {
+        ::close( mAtlasFile );
+        mAtlasFile = -1;
+    }
+    if( mIndexFile >= 0 )
+    {
+        ::close( mIndexFile );
+        mIndexFile = -1;
+    }
+}
+
+int ThumbnailAtlas::workerMain( void* data )
+{
+    flushSubnormals();
+    ( (ThumbnailAtlas*)data )->workerLoop();
+    return 0;
+}
+
+void ThumbnailAtlas::workerLoop()
+{
+    SpanScratch scratch;
+    std::vector<Uint32> pixels( THUMB_SIZE * THUMB_SIZE );
+    SDL_Rect all = { 0, 0, THUMB_SIZE, THUMB_SIZE };
+
+    SDL_LockMutex( mMutex );
+    while( !mQuit )
+    {
+        if( mQueue.empty() )
+        {
+            SDL_CondWait( mWork, mMutex );
+            continue;
+        }
+        std::pair<Uint64, Node*> request = mQueue.front();
+        mQueue.pop_front();
+        mRendering++;
+        mRenderingHash = request.first;
+        SDL_UnlockMutex( mMutex );
+
+        renderRegion( request.second, THUMB_SIZE, THUMB_SIZE, DEFAULT_VIEW, all, &pixels[ 0 ], THUMB_SIZE, scratch );
+        deleteTree( request.second );
+
+        //Fill a fresh slot, then publish it in the index so a torn write is never found
+        SDL_LockMutex( mMutex );
+        int slot = mNextSlot;
+        Uint32* page = mapPage( slot / ATLAS_PAGE_THUMBS );
+        SDL_UnlockMutex( mMutex );
+        bool stored = false;
+        if( page != NULL )
+        {
+            int cell = slot % ATLAS_PAGE_THUMBS;
+            Uint32* out = page + ( cell / ATLAS_COLUMNS ) * THUMB_SIZE * ATLAS_PAGE_WIDTH + ( cell % ATLAS_COLUMNS ) * THUMB_SIZE;
+            for( int y = 0; y < THUMB_SIZE; ++y )
+            {
+                memcpy( out + y * ATLAS_PAGE_WIDTH, &pixels[ y * THUMB_SIZE ], THUMB_SIZE * 4 );
+            }
+            AtlasEntry entry = { request.first, (Uint32)slot, ATLAS_CHECK };
+            off_t end = lseek( mIndexFile, 0, SEEK_END );
+            stored = write( mIndexFile, &entry, sizeof( entry ) ) == sizeof( entry );
+            if( !stored && end >= 0 && ftruncate( mIndexFile, end ) != 0 )
+            {
+                SDL_Log( "Unable to repair thumbnail index!\n" );
+            }
+        }
+
+        //A thumbnail that can't be stored is remembered as failed rather than queued forever
+        SDL_LockMutex( mMutex );
+        if( stored )
+        {
+            mSlots[ request.first ] = slot;
+            mNextSlot++;
+        }
+        else
+        {
+            SDL_Log( "Unable to store thumbnail %016llx!\n", (unsigned long long)request.first );
+            mSlots[ request.first ] = ATLAS_FAILED;
+        }
+        mRendering--;
+    }
+    SDL_UnlockMutex( mMutex );
+}
+
+Uint32* ThumbnailAtlas::mapPage( int page )
+{
+    if( page < (int)mPages.size() && mPages[ page ] != NULL )
+    {
+        return mPages[ page ];
+    }
+    if( page >= (int)mPages.size() )
+    {
+        mPages.resize( page + 1, NULL );
+    }
+
+    //Reserve the page's blocks, a store into a hole the disk can't fill would raise SIGBUS
+    if( posix_fallocate( mAtlasFile, (off_t)page * ATLAS_PAGE_BYTES, ATLAS_PAGE_BYTES ) != 0 )
+    {
+        SDL_Log( "Unable to grow thumbnail atlas!\n" );
+        return NULL;
+    }
+    void* map = mmap( NULL, ATLAS_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, mAtlasFile, (off_t)page * ATLAS_PAGE_BYTES );
+    if( map == MAP_FAILED )
+    {
+        SDL_Log( "Unable to map thumbnail atlas page!\n" );
+        return NULL;
+    }
+    mPages[ page ] = (Uint32*)map;
+
+    return mPages[ page ];
+}
+
+/*
+ * Genome files in a folder, by name
+ */
+std::vector<std::string> listGenomes(std::string dir){
+    std::vector<std::string> paths;
+    DIR* folder = opendir(dir.c_str());
+    if (folder == NULL){
+        return paths;
+    }
+    while (struct dirent* entry = readdir(folder)){
+        std::string name = entry->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0){
+            paths.push_back(dir + "/" + name);
+        }
+    }
+    closedir(folder);
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+/*
+ * Write every thumbnail of a folder of genomes into one PNG, using and filling the folder's thumbnail cache
+ */
+int exportContactSheet(std::string dir, std::string path, int columns){
+    std::vector<std::string> paths = listGenomes(dir);
+    std::vector<Node*> genomes;
+    std::vector<Uint64> hashes;
+    for (size_t n = 0; n < paths.size(); n++){
+        Node* genome = loadGenome(paths[n]);
+        if (genome != NULL){
+            genomes.push_back(genome);
+            hashes.push_back(hashGenome(genome));
+        }
+    }
+    if (genomes.empty() || columns <= 0){
+        SDL_Log("No genomes in %s!\n", dir.c_str());
+        return 1;
+    }
+
+    ThumbnailAtlas atlas;
+    if (!atlas.open(dir + "/thumbs")){
+        return 1;
+    }
+
+    //Ask for every thumbnail until none are missing, the queue only holds so many at once
+    Uint64 start = SDL_GetPerformanceCounter();
+    std::vector<int> slots(genomes.size(), -1);
+    int rendered = 0;
+    bool failed = false;
+    while (!failed){
+        int missing = 0;
+        for (size_t n = 0; n < genomes.size(); n++){
+            if (slots[n] == -1 && (slots[n] = atlas.find(hashes[n], genomes[n])) == -1){
+                missing++;
+            }
+        }
+        failed = std::count(slots.begin(), slots.end(), ATLAS_FAILED) > 0;
+        if (missing == 0){
+            break;
+        }
+        rendered = std::max(rendered, missing);
+        SDL_Delay(10);
+    }
+    if (failed){
+        SDL_Log("Unable to store thumbnails in %s/thumbs!\n", dir.c_str());
+    }
+
+    PngWriter png;
+    int rows = (genomes.size() + columns - 1) / columns;
+    bool success = !failed && png.open(path, columns * THUMB_SIZE, rows * THUMB_SIZE);
+    std::vector<Uint32> line(columns * THUMB_SIZE);
+    for (int row = 0; row < rows && success; row++){
+        for (int y = 0; y < THUMB_SIZE && success; y++){
+            for (int column = 0; column < columns; column++){
+                size_t n = row * columns + column;
+                const Uint32* pixels = n < slots.size() ? atlas.getPixels(slots[n]) : NULL;
+                for (int x = 0; x < THUMB_SIZE; x++){
+                    line[column * THUMB_SIZE + x] = pixels != NULL ? pixels[y * ATLAS_PAGE_WIDTH + x] : 0x000000FF;
+                }
+            }
+            success = png.writeRow(&line[0]);
+        }
+    }
+    success = png.close() && success;
+    printf("contact sheet: %d thumbnails, %d rendered, %.2f s\n", (int)genomes.size(), rendered,
+           (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency());
+
+    atlas.close();
+    for (size_t n = 0; n < genomes.size(); n++){
+        deleteTree(genomes[n]);
+    }
+    return success ? 0 : 1;
+}
+
+//Atlas pages the library shows, uploaded as textures a thumbnail at a time, least recently drawn reused first
+const int ATLAS_TEXTURES = 4;
+
+struct AtlasTexture{
+    LTexture texture;
+    int page;
+    std::vector<bool> uploaded;
+    Uint32 used;
+};
+
+//A saved genome in the library
+struct LibraryItem{
+    Node* genome;
+    Uint64 hash;
+};
+
+ThumbnailAtlas gAtlas;
+AtlasTexture gAtlasTextures[ATLAS_TEXTURES];
+std::vector<LibraryItem> gLibrary;
+std::string gLibraryDir;
+bool gBrowsing = false;
+double gLibraryScroll = 0;
+
+/*
+ * Load the library's genomes, parsed but not rendered, newest first
+ */
+void openLibrary(){
+    std::vector<std::string> paths = listGenomes(gLibraryDir);
+    for (int n = (int)paths.size() - 1; n >= 0; n--){
+        Node* genome = loadGenome(paths[n]);
+        if (genome != NULL){
+            LibraryItem item = { genome, hashGenome(genome) };
+            gLibrary.push_back(item);
+        }
+    }
+    gLibraryScroll = 0;
+}
+
+void closeLibrary(){
+    for (size_t n = 0; n < gLibrary.size(); n++){
+        deleteTree(gLibrary[n].genome);
+    }
+    gLibrary.clear();
+}
+
+/*
+ * Save a genome into the library, named so the folder lists oldest to newest
+ */
+bool saveToLibrary(Node* genome){
+    if (gLibraryDir.empty()){
+        return false;
+    }
+    Uint64 hash = hashGenome(genome);
+    char name[64];
+    snprintf(name, sizeof(name), "/%010lld-%08x.txt", (long long)time(0), (unsigned)hash);
+    std::ofstream out((gLibraryDir + name).c_str());
+    writeGenome(genome, out);
+    out << "\n";
+    return (bool)out;
+}
+
+/*
+ * Library cell under a screen point in a grid starting at top, or -1
+ */
+int libraryCellAt(SDL_Point point, int top, int height){
+    int columns = std::max(1, gScreenRect.w / THUMB_SIZE);
+    if (point.y < top || point.y >= top + height || point.x >= columns * THUMB_SIZE){
+        return -1;
+    }
+    int cell = (int)((point.y - top + gLibraryScroll) / THUMB_SIZE) * columns + point.x / THUMB_SIZE;
+    return cell < gLibrary.size() ? cell : -1;
+}
+
+/*
+ * Draw a cached thumbnail from the texture holding its atlas page, uploading it if the page is new there
+ */
+void renderThumbnail(int slot, int x, int y, SDL_Rect* visible){
+    int page = slot / ATLAS_PAGE_THUMBS;
+    int cell = slot % ATLAS_PAGE_THUMBS;
+    AtlasTexture* target = &gAtlasTextures[0];
+    for (int n = 0; n < ATLAS_TEXTURES; n++){
+        if (gAtlasTextures[n].page == page && gAtlasTextures[n].texture.getWidth() > 0){
+            target = &gAtlasTextures[n];
+            break;
+        }
+        if (gAtlasTextures[n].used < target->used){
+            target = &gAtlasTextures[n];
+        }
+    }
+    if (target->texture.getWidth() == 0){
+        if (!target->texture.createBlank(ATLAS_PAGE_WIDTH, ATLAS_PAGE_WIDTH)){
+            return;
+        }
+        target->page = -1;
+    }
+    if (target->page != page){
+        target->page = page;
+        target->uploaded.assign(ATLAS_PAGE_THUMBS, false);
+    }
+    target->used = SDL_GetTicks();
+
+    SDL_Rect rect = { (cell % ATLAS_COLUMNS) * THUMB_SIZE, (cell / ATLAS_COLUMNS) * THUMB_SIZE, THUMB_SIZE, THUMB_SIZE };
+    if (!target->uploaded[cell]){
+        const Uint32* pixels = gAtlas.getPixels(slot);
+        if (pixels == NULL){
+            return;
+        }
+        target->texture.updatePixels(&rect, (void*)pixels, ATLAS_PAGE_WIDTH * 4);
+        target->uploaded[cell] = true;
+    }
+
+    //Only the part of the thumbnail inside the library's band
+    SDL_Rect clip = { rect.x + visible->x, rect.y + visible->y, visible->w, visible->h };
+    target->texture.render(x + visible->x, y + visible->y, &clip);
+}
+
+/*
+ * Draw the library as a scrolling grid of thumbnails in a band of the screen. Thumbnails
+ * missing from the cache are outlined while they render in the background
+ */
+void renderLibrary(int top, int height){
+    int columns = std::max(1, gScreenRect.w / THUMB_SIZE);
+    int rows = (gLibrary.size() + columns - 1) / columns;
+    gLibraryScroll = std::max(0.0, std::min(gLibraryScroll, (double)rows * THUMB_SIZE - height));
+
+    int first = (int)(gLibraryScroll / THUMB_SIZE) * columns;
+    SDL_SetRenderDrawColor(gRenderer, 128, 128, 128, 255);
+    for (int n = first; n < gLibrary.size(); n++){
+        int x = (n % columns) * THUMB_SIZE;
+        int y = top + (n / columns) * THUMB_SIZE - (int)gLibraryScroll;
+        if (y >= top + height){
+            break;
+        }
+        int clipTop = std::max(0, top - y);
+        SDL_Rect visible = { 0, clipTop, THUMB_SIZE, std::min(THUMB_SIZE, top + height - y) - clipTop };
+        int slot = gAtlas.find(gLibrary[n].hash, gLibrary[n].genome);
+        if (slot >= 0){
+            renderThumbnail(slot, x, y, &visible);
+        }else{
+            SDL_Rect outline = { x + 8, y + visible.y, THUMB_SIZE - 16, visible.h };
+            SDL_RenderDrawRect(gRenderer, &outline);
+        }
+    }
+}
+
+void printUsage(){
+    printf("usage:\n");
+    printf("  eruption --export <genome|-> <out.png|out.ppm> <width> <height> [x y scale]\n");
+    printf("  eruption --serve <socket path> [--cache-mb <megabytes>]\n");
+    printf("  eruption --coordinate <genome|-> <out.png|out.ppm> <width> <height> [x y scale] [--port <port>] [--spawn <workers>]\n");
+    printf("  eruption --work <coordinator host> [--port <port>]\n");
+    printf("  eruption --farm <genome|-> <out dir> <count> <width> <height>\n");
+    printf("  eruption --animate <genome|-> <out.y4m|-> <width> <height> <frames> [x y scale] [--fps <rate>] [--raw]\n");
+    printf("  eruption --lineage <journal> [generation|last] [--ancestors]\n");
+    printf("  eruption --contact-sheet <genome dir> <out.png> [columns]\n");
+    printf("  eruption --compile <genome|-> <out.cpp>\n");
+    printf("options:\n");
+    printf("  --aa <samples>          supersample edge pixels with this many jittered samples, up to 256\n");
+    printf("  --aa-threshold <0-255>  channel difference to a neighbour that counts as an edge\n");
+    printf("  --aa-budget <samples>   extra samples allowed per pixel on average, up to 256\n");
+    printf("  --dedupe <bits>         farm rejects art within this many fingerprint bits of earlier art, -1 keeps all\n");
+    printf("  --fps <rate>            frame rate written into the Y4M header\n");
+    printf("  --raw                   write animation frames as bare RGB bytes instead of Y4M\n");
+    printf("  --ancestors             list the generations a journaled generation descends from\n");
+    printf("  --profile               report evaluations, time and NaN/Inf/subnormal results per operator\n");
+    printf("  --canonical             hand NaN, Inf and subnormal results on as 0 and flush subnormals, the same everywhere\n");
+    printf("  --kernel <library>      render the genome a library built from --compile output was compiled from natively\n");
+}
+
+/*
+ * Headless tools, run without a window
+ */
+int runTool(int argc, char* args[]){
+    std::string tool = args[1];
+
+    //Options may appear anywhere after the tool
+    std::vector<std::string> params;
+    AntiAlias aa = NO_ANTI_ALIAS;
+    size_t cacheBytes = SERVICE_CACHE_BYTES;
+    int dedupe = DUPLICATE_DISTANCE;
+    int port = COORDINATOR_PORT;
+    int spawn = 0;
+    int fps = ANIMATION_FPS;
+    bool raw = false;
+    bool ancestors = false;
+    std::string kernel;
+    for (int n = 2; n < argc; n++){
+        std::string arg = args[n];
+        if (arg == "--aa" && n + 1 < argc){
+            aa.samples = atoi(args[++n]);
+        }else if (arg == "--aa-threshold" && n + 1 < argc){
+            aa.threshold = atoi(args[++n]);
+        }else if (arg == "--aa-budget" && n + 1 < argc){
+            aa.budget = atof(args[++n]);
+        }else if (arg == "--dedupe" && n + 1 < argc){
+            dedupe = atoi(args[++n]);
+        }else if (arg == "--port" && n + 1 < argc){
+            port = atoi(args[++n]);
+        }else if (arg == "--spawn" && n + 1 < argc){
+            spawn = atoi(args[++n]);
+        }else if (arg == "--fps" && n + 1 < argc){
+            fps = atoi(args[++n]);
+        }else if (arg == "--raw"){
+            raw = true;
+        }else if (arg == "--ancestors"){
+            ancestors = true;
+        }else if (arg == "--profile"){
+            gProfiling = true;
+        }else if (arg == "--canonical"){
+            gCanonical = true;
+        }else if (arg == "--cache-mb" && n + 1 < argc){
+            cacheBytes = (size_t)atoi(args[++n]) << 20;
+        }else if (arg == "--kernel" && n + 1 < argc){
+            kernel = args[++n];
+        }else{
+            params.push_back(arg);
+        }
+    }
+    if (!checkAntiAlias(aa)){
+        SDL_Log("Anti-aliasing samples and budget must be from 0 to %d!\n", AA_MAX_SAMPLES);
+        printUsage();
+        return 1;
+    }
+    flushSubnormals();
+    if (!kernel.empty() && !loadKernel(kernel)){
+        return 1;
+    }
+    if (!kernel.empty() && gBaked.canonical != gCanonical){
+        SDL_Log("%s was compiled %s --canonical, interpreting instead\n", kernel.c_str(), gBaked.canonical ? "with" : "without");
+    }
+
+    if (tool == "--export" && params.size() >= 4){
+        int width = atoi(params[2].c_str());
+        int height = atoi(params[3].c_str());
+        if (width <= 0 || height <= 0){
+            SDL_Log("Export size must be positive!\n");
+            printUsage();
+            return 1;
+        }
+        Node* genome = preferBaked(loadGenome(params[0]));
+        if (genome == NULL){
+            SDL_Log("Unable to read genome!\n");
+            return 1;
+        }
+        if (gBaked.genome != NULL && gBaked.canonical == gCanonical && genome != gBaked.genome){
+            SDL_Log("The genome isn't the one %s was compiled from, interpreting it\n", kernel.c_str());
+        }
+        View view = DEFAULT_VIEW;
+        if (params.size() >= 7){
+            view.x = atof(params[4].c_str());
+            view.y = atof(params[5].c_str());
+            view.scale = atof(params[6].c_str());
+        }
+        int result = exportImage(genome, params[1], width, height, view, aa);
+        deleteTree(genome);
+        return result;
+    }
+
+    if (tool == "--animate" && params.size() >= 5){
+        Node* genome = preferBaked(loadGenome(params[0]));
+        if (genome == NULL){
+            SDL_Log("Unable to read genome!\n");
+            return 1;
+        }
+        if (gBaked.genome != NULL && gBaked.canonical == gCanonical && genome != gBaked.genome){
+            SDL_Log("The genome isn't the one %s was compiled from, interpreting it\n", kernel.c_str());
+        }
+        View view = DEFAULT_VIEW;
+        if (params.size() >= 8){
+            view.x = atof(params[5].c_str());
+            view.y = atof(params[6].c_str());
+            view.scale = atof(params[7].c_str());
+        }
+        int result = exportAnimation(genome, params[1], atoi(params[2].c_str()), atoi(params[3].c_str()), atoi(params[4].c_str()), view, fps, raw, cacheBytes);
+        deleteTree(genome);
+        return result;
+    }
+
+    if (tool == "--lineage" && params.size() >= 1){
+        LineageJournal journal;
+        if (!journal.open(params[0])){
+            return 1;
+        }
+        if (params.size() < 2){
+            printf("%lld generations\n", (long long)journal.getCount());
+            return 0;
+        }
+        Sint64 generation = params[1] == "last" ? journal.getCount() - 1 : atoll(params[1].c_str());
+        if (ancestors){
+            for (Sint64 n = generation; n >= 0; n = journal.getParent(n)){
+                printf("%lld\n", (long long)n);
+            }
+            return 0;
+        }
+        Node* genome = journal.load(generation);
+        if (genome == NULL){
+            SDL_Log("Unable to load generation %lld!\n", (long long)generation);
+            return 1;
+        }
+        printf("%s\n", genomeToString(genome).c_str());
+        deleteTree(genome);
+        return 0;
+    }
+
+    if (tool == "--compile" && params.size() >= 2){
+        Node* genome = loadGenome(params[0]);
+        if (genome == NULL){
+            SDL_Log("Unable to read genome!\n");
+            return 1;
+        }
+        int result = compileGenome(genome, params[1]);
+        deleteTree(genome);
+        return result;
+    }
+
+    if (tool == "--contact-sheet" && params.size() >= 2){
+        return exportContactSheet(params[0], params[1], params.size() >= 3 ? atoi(params[2].c_str()) : 8);
+    }
+
+    if (tool == "--farm" && params.size() >= 5){
+        int count = atoi(params[2].c_str());
+        int width = atoi(params[3].c_str());
+        int height = atoi(params[4].c_str());
+        if (count <= 0 || width <= 0 || height <= 0){
+            SDL_Log("Farm count and size must be positive!\n");
+            printUsage();
+            return 1;
+        }
+        Node* seed = loadGenome(params[0]);
+        if (seed == NULL){
+            SDL_Log("Unable to read genome!\n");
+            return 1;
+        }
+        ArtFarm farm;
+        int result = farm.run(seed, params[1], count, width, height, aa, dedupe);
+        deleteTree(seed);
+        return result;
+    }
+
+    if (tool == "--coordinate" && params.size() >= 4){
+        int width = atoi(params[2].c_str());
+        int height = atoi(params[3].c_str());
+        if (width <= 0 || height <= 0){
+            SDL_Log("Export size must be positive!\n");
+            printUsage();
+            return 1;
+        }
+        Node* genome = loadGenome(params[0]);
+        if (genome == NULL){
+            SDL_Log("Unable to read genome!\n");
+            return 1;
+        }
+        View view = DEFAULT_VIEW;
+        if (params.size() >= 7){
+            view.x = atof(params[4].c_str());
+            view.y = atof(params[5].c_str());
+            view.scale = atof(params[6].c_str());
+        }
+        TileCoordinator coordinator;
+        int result = coordinator.run(genome, params[1], width, height, view, aa, port, spawn);
+        deleteTree(genome);
+        return result;
+    }
+
+    if (tool == "--work" && params.size() >= 1){
+        return runWorker(params[0], port);
+    }
+
+    if (tool == "--serve" && params.size() >= 1){
+        return runService(params[0], aa, cacheBytes);
+    }
+
+    printUsage();
+    return 1;
+}
+
+
+int main( int argc, char* args[] )
+{
+    //Headless tools run without a window
+    if (argc > 1){
+        return runTool(argc, args);
+    }
+
+#ifdef BAKED_GENOME
+    //A viewer built around a genome evaluates in the mode it was compiled in
+    gCanonical = eruptionCanonical() != 0;
+#endif
+    flushSubnormals();
+
+    srand(time(0));
+    init();
+
+    loadMedia();
+
+    //Main loop flag
+    bool quit = false;
+
+    //Event handler
+    SDL_Event e;
+
+    //Touch variables
+    SDL_Point touchLocation = { gScreenRect.w / 2, gScreenRect.h / 2 };
+    //LTexture* currentTexture = &gItemSpark;
+
+    SDL_SetRenderDrawBlendMode(gRenderer, SDL_BLENDMODE_BLEND);
+
+    bool holding = false;
+    bool tapped = false;
+    int fingers = 0;
+    double pan_x = 0;
+    double pan_y = 0;
+    double zoom = 1;
+    SDL_Point zoomFocus = { 0, 0 };
+    bool speculated = false;
+    double dragged = 0;
+    int fade = 0;
+    int delay = 0;
+    int msec;
+    srand (time(NULL));
+
+    //Art is rendered at a quarter of the screen width and magnified by 4
+    int r_x = gScreenRect.w * .25;
+    int r_y = gScreenRect.w * .25;
+    int art_y = gScreenRect.h * .5 - r_y * 2;
+    layoutButtons(art_y + r_y * 4, gScreenRect.h - 200);
+
+    //Carry on from the last generation journaled, or start the journal with this one
+    char* prefPath = SDL_GetPrefPath("MathArtwork", "Eruption");
+    if (prefPath != NULL && gJournal.open(std::string(prefPath) + "lineage.journal")){
+        Node* last = gJournal.getCount() > 0 ? gJournal.load(gJournal.getCount() - 1) : NULL;
+        if (last != NULL){
+            deleteTree(root);
+            root = last;
+            gGeneration = gJournal.getCount() - 1;
+        }else{
+            recordGeneration(root);
+        }
+    }
+
+#ifdef BAKED_GENOME
+    //A viewer built around a genome opens on it, rendered by its compiled code
+    if (bakeGenome(eruptionGenome(), eruptionSpan, gCanonical, NULL)){
+        if (sameTree(root, gBaked.genome)){
+            deleteTree(root);
+            root = copyTree(gBaked.genome);
+        }else{
+            setRoot(copyTree(gBaked.genome));
+        }
+    }
+#endif
+
+    //Saved genomes, and the thumbnail cache for browsing them
+    if (prefPath != NULL){
+        gLibraryDir = std::string(prefPath) + "library";
+        mkdir(gLibraryDir.c_str(), 0755);
+        gAtlas.open(std::string(prefPath) + "thumbs");
+    }
+    SDL_free(prefPath);
+
+    gSeen.insert(fingerprint(root, gView, gHashScratch));
+
+    //Render on every core except the one running this loop
+    gPipeline.init(SDL_GetCPUCount() - 1);
+    gPipeline.start(root, r_x, r_y);
+
+    //While application is running
+    while( !quit )
+    {
+        //Handle events on queue
+        while( SDL_PollEvent( &e ) != 0 )
+        {
+            //User requests quit
+            if( e.type == SDL_QUIT )
+            {
+                quit = true;
+            }
+                //Window event
+            else if( e.type == SDL_WINDOWEVENT )
+            {
+
+            }
+                //Touch down
+            else if( e.type == SDL_FINGERDOWN )
+            {
+                touchLocation.x = e.tfinger.x * gScreenRect.w;
+                touchLocation.y = e.tfinger.y * gScreenRect.h;
+                fingers++;
+                dragged = 0;
+            }
+                //Touch motion
+            else if( e.type == SDL_FINGERMOTION )
+            {
+                touchLocation.x = e.tfinger.x * gScreenRect.w;
+                touchLocation.y = e.tfinger.y * gScreenRect.h;
+                holding = true;
+
+                //One finger drags the view, in art pixels
+                if (gExploring && fingers == 1){
+                    pan_x -= e.tfinger.dx * gScreenRect.w / 4;
+                    pan_y -= e.tfinger.dy * gScreenRect.h / 4;
+                }
+
+                //One finger scrolls the library
+                if (gBrowsing && fingers == 1){
+                    gLibraryScroll -= e.tfinger.dy * gScreenRect.h;
+                }
+                dragged += std::fabs(e.tfinger.dx * gScreenRect.w) + std::fabs(e.tfinger.dy * gScreenRect.h);
+            }
+                //Touch release
+            else if( e.type == SDL_FINGERUP )
+            {
+                touchLocation.x = e.tfinger.x * gScreenRect.w;
+                touchLocation.y = e.tfinger.y * gScreenRect.h;
+                holding = false;
+                tapped = true;
+                if (fingers > 0) fingers--;
+            }
+                //Pinch
+            else if( e.type == SDL_MULTIGESTURE )
+            {
+                if (gExploring){
+                    zoom *= std::max(0.5, std::min(2.0, 1.0 - e.mgesture.dDist * 2));
+                    zoomFocus.x = e.mgesture.x * gScreenRect.w / 4;
+                    zoomFocus.y = (e.mgesture.y * gScreenRect.h - art_y) / 4;
+                }
+            }
+                //Mouse wheel zooms about the middle
+            else if( e.type == SDL_MOUSEWHEEL )
+            {
+                if (gExploring){
+                    zoom *= e.wheel.y > 0 ? 0.8 : 1.25;
+                    zoomFocus.x = r_x / 2;
+                    zoomFocus.y = r_y / 2;
+                }
+            }
+        }
+
+        //Apply the frame's drags and pinches in one go
+        if (gExploring){
+            int dx = pan_x;
+            int dy = pan_y;
+            if (dx != 0 || dy != 0){
+                pan_x -= dx;
+                pan_y -= dy;
+                gPipeline.pan(dx, dy);
+            }
+            if (zoom != 1){
+                gPipeline.zoom(zoom, zoomFocus.x, zoomFocus.y);
+                zoom = 1;
+            }
+            gView = gPipeline.getView();
+        }
+
+        //Toolbar and gallery picks act on release
+        if (tapped){
+            tapped = false;
+            int button = buttonAt(touchLocation);
+            int cell = gPipeline.getCellAt(touchLocation.x / 4, (touchLocation.y - art_y) / 4);
+
+            if (button == BUTTON_GALLERY || button == BUTTON_EXPLORE){
+                gBrowsing = false;
+                closeLibrary();
+            }
+
+            if (button == BUTTON_GALLERY){
+                //Cycle single image, 3x3 and 4x4 galleries
+                gGalleryColumns = gGalleryColumns == 0 ? 3 : gGalleryColumns == 3 ? 4 : 0;
+                gExploring = false;
+                dropCandidates();
+                speculated = false;
+                if (gGalleryColumns > 0){
+                    startGallery(root, gGalleryColumns, r_x, r_y);
+                }else{
+                    clearGallery();
+                    gPipeline.start(root, r_x, r_y, gView);
+                }
+            }else if (button == BUTTON_EXPLORE){
+                //Leaving explore mode goes back to the whole function
+                gExploring = !gExploring;
+                gGalleryColumns = 0;
+                clearGallery();
+                dropCandidates();
+                speculated = false;
+                pan_x = 0;
+                pan_y = 0;
+                zoom = 1;
+                if (!gExploring){
+                    gView = DEFAULT_VIEW;
+                }
+                gPipeline.start(root, r_x, r_y, gView);
+            }else if (button == BUTTON_SAVE){
+                saveToLibrary(root);
+                if (gBrowsing){
+                    closeLibrary();
+                    openLibrary();
+                }
+            }else if (button == BUTTON_UNDO || button == BUTTON_REDO){
+                //Step back or forward through the roots, showing it however the art is being shown
+                bool stepped = button == BUTTON_UNDO ? stepHistory(gUndo, gRedo) : stepHistory(gRedo, gUndo);
+                if (stepped){
+                    gBrowsing = false;
+                    closeLibrary();
+                    dropCandidates();
+                    speculated = false;
+                    if (gGalleryColumns > 0){
+                        startGallery(root, gGalleryColumns, r_x, r_y);
+                    }else{
+                        gPipeline.start(root, r_x, r_y, gView);
                     }
-                    temp4 << strikes;
-                    break;
+                }
+            }else if (button == BUTTON_LIBRARY){
+                //Browse saved art, leaving it goes back to the art being evolved
+                gBrowsing = !gBrowsing;
+                gGalleryColumns = 0;
+                gExploring = false;
+                gView = DEFAULT_VIEW;
+                clearGallery();
+                dropCandidates();
+                speculated = false;
+                closeLibrary();
+                if (gBrowsing){
+                    openLibrary();
+                }else{
+                    gPipeline.start(root, r_x, r_y, gView);
+                }
+            }else if (gBrowsing && dragged < THUMB_SIZE / 4){
+                //A picked thumbnail becomes the art being evolved
+                int picked = libraryCellAt(touchLocation, art_y, r_y * 4);
+                if (picked >= 0){
+                    setRoot(copyTree(gLibrary[picked].genome));
+                    gBrowsing = false;
+                    closeLibrary();
+                    gPipeline.start(root, r_x, r_y, gView);
+                }
+            }else if (gGalleryColumns > 0 && touchLocation.y >= art_y && cell >= 0){
+                //The picked thumbnail becomes the parent of the next generation
+                setRoot(copyTree(gGallery[cell]));
+                startGallery(root, gGalleryColumns, r_x, r_y);
+            }
+        }
+
+        //Clear screen
+        SDL_SetRenderDrawColor( gRenderer, 0x00, 0x00, 0x00, 0xFF );
+        SDL_RenderClear( gRenderer );
+
+        sky = 1;
+        gSkyBlue.render(0, 0);
+        sky = 0;
+
+        if (holding == true){
+            fade = 100;
+        }else{
+            if (fade > 0) fade -= 4;
+        }
+        if (delay > 0){ delay-=1; }
+
+        //Upload rows the workers finished and draw the art magnified by 4
+        gPipeline.upload(gArt);
+        if (gBrowsing){
+            renderLibrary(art_y, r_y * 4);
+        }else{
+            scalex = 4;
+            scaley = 4;
+            gArt.render(0, art_y);
+            scalex = 1;
+            scaley = 1;
+        }
+        renderButtons();
+
+
+
+        //Debug Text
+        std::ostringstream temp;
+        std::ostringstream temp2;
+        std::ostringstream temp3, temp4;
+        recur(root);
+        for (int n = 0; n < v.size(); n++){
+            if (n < 25)
+                temp << v[n];
+            else if (n < 50)
+                temp2 << v[n];
+            else if (n < 75)
+                temp3 << v[n];
+            else
+                temp4 << v[n];
+        }
+        v.clear();
+
+        msec = gPipeline.getRenderTime();
+        temp4 << " " << msec << " "; //<< getValue(root);
+        //Completed an Image
+        if (gPipeline.isComplete()){
+            temp4 << "Click...";
+
+            //Render the next children while the user looks at this one
+            if (!speculated && gGalleryColumns == 0 && !gExploring && !gBrowsing){
+                speculate(root, r_x, r_y, gView);
+                speculated = true;
+            }
+        }
+        if (holding == 1 && delay <= 0 && gGalleryColumns == 0 && !gExploring && !gBrowsing && buttonAt(touchLocation) < 0) {
+            bool swapped = false;
 
+            if (touchLocation.y < gScreenRect.h / 4.0){
+                setRoot(new Node(0));
+            }else if (!gCandidates.empty()){
+                //The next child was already rendered in the background, swap it in
+                Candidate next = gCandidates[0];
+                gCandidates.erase(gCandidates.begin());
+                gSeen.insert(next.hash);
+                swapped = gPipeline.promote(next.job);
+                setRoot(next.genome);
+            }else {
+
+                //Mutation leaves root alone and shares what it didn't change, so a whole batch of candidates costs little
+                Node* child = NULL;
+                int duplicates = 0;
+                int empty = 0;
+                while (child == NULL) {
+                    //Screen the batch on a sparse grid and take the best child, skipping ones that look like art already shown
+                    std::vector<Node*> children;
+                    screenChildren(root, gView, NULL, children, empty >= SCREEN_TRIES);
+                    empty += children.empty() ? 1 : 0;
+                    for (int n = 0; n < children.size(); n++) {
+                        if (child != NULL) {
+                            deleteTree(children[n]);
+                            continue;
+                        }
+                        Uint64 hash = fingerprint(children[n], gView, gHashScratch);
+                        if (duplicates < DUPLICATE_TRIES && looksSeen(hash, std::vector<Uint64>())) {
+                            duplicates++;
+                            deleteTree(children[n]);
+                            continue;
+                        }
+                        gSeen.insert(hash);
+                        child = children[n];
+                    }
+                    temp4 << children.size();
                 }
+                setRoot(child);
+            }
+
+            //Children of the old root are no use any more
+            dropCandidates();
+            speculated = false;
+
+            //Cancels the render in flight
+            if (!swapped){
+                gPipeline.start(root, r_x, r_y, gView);
             }
             delay = 10;
         }
         //temp << messages;
         temp << " "; temp2 << " "; temp3 << " "; temp4 << " ";
-        SDL_Color textColor = { 255,255,255 };
-        gTextTexture.loadFromRenderedText(temp.str(), textColor);
-        gTextTexture.render(0, gScreenRect.h-200);
-        gTextTexture2.loadFromRenderedText(temp2.str(), textColor);
-        gTextTexture2.render(0, gScreenRect.h-150);
-        gTextTexture3.loadFromRenderedText(temp3.str(), textColor);
-        gTextTexture3.render(0, gScreenRect.h-100);
-        gTextTexture4.loadFromRenderedText(temp4.str(), textColor);
-        gTextTexture4.render(0, gScreenRect.h-50);
+        renderTextLine(gTextTexture, gTextShown[0], temp.str(), gScreenRect.h-200);
+        renderTextLine(gTextTexture2, gTextShown[1], temp2.str(), gScreenRect.h-150);
+        renderTextLine(gTextTexture3, gTextShown[2], temp3.str(), gScreenRect.h-100);
+        renderTextLine(gTextTexture4, gTextShown[3], temp4.str(), gScreenRect.h-50);
 
         //Update screen
         SDL_RenderPresent( gRenderer );
 
     }
 
+    dropCandidates();
+    clearGallery();
+    gPipeline.free();
+    gJournal.close();
+    clearHistory(gUndo);
+    clearHistory(gRedo);
+    closeLibrary();
+    gAtlas.close();
+    for (int n = 0; n < ATLAS_TEXTURES; n++){
+        gAtlasTextures[n].texture.free();
+    }
     close();
 
     return 0;
 }
+
+#endif